@@ -0,0 +1,390 @@
+/* ak_arena.h - chunked bump allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_ARENA_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_arena.h to emit the implementation.
+
+     ALLOCKIT_ARENA_CHUNK_SIZE (default: 65536)
+       Size in bytes of the chunks requested from the backing
+       allocator when an arena is initialized with a chunk size of
+       0. Allocations larger than this are given a chunk of their own.
+
+   USAGE
+
+       An arena hands out memory by bumping a pointer through large
+       chunks obtained from a backing allocator, which makes `alloc`
+       only a handful of instructions. Individual allocations are
+       generally not freed; instead, everything allocated from the
+       arena is released at once with `ak_arena_reset`.
+
+         #include "allockit.h"
+         #include "ak_arena.h"
+
+         void
+         handle_request(AkAlloc *backing)
+         {
+           AkArena arena = {0};
+           ak_arena_init(&arena, backing, 0);
+
+           char *buf = ak_alloc(&arena.alloc, char, 512);
+           ...
+
+       `ak_arena_reset` releases every allocation in O(1). The chunks
+       themselves are kept and reused by later allocations, so an
+       arena that is reset between requests stops touching the
+       backing allocator once it has grown to fit the largest
+       request.
+
+           ak_arena_reset(&arena);
+           ...
+
+       `ak_arena_deinit` returns all chunks to the backing allocator.
+
+           ak_arena_deinit(&arena);
+         }
+
+       To release only part of an arena, `ak_arena_mark` captures its
+       current top, and `ak_arena_rollback` later releases everything
+       allocated since, in O(1). Marks nest, so each scope can release
+       its own allocations. A mark is only valid until the arena is
+       reset or rolled back past it. As with a reset, the chunks
+       rolled back over are kept for later allocations.
+
+         AkArenaMark mark = ak_arena_mark(&arena);
+         Value *args = ak_alloc(&arena.alloc, Value, argc);
+         ...
+         ak_arena_rollback(&arena, mark);
+
+       `free` is a no-op, except when `addr` is the most recent
+       allocation, in which case its space is given back to the
+       arena. `ak_free_sized` goes further, giving back space for any
+       allocation that ends at the top of the arena, so allocations
+       freed in reverse order are all reclaimed. Likewise, `resize`
+       succeeds only for the most recent allocation, growing or
+       shrinking it in place as long as it still fits within the
+       current chunk.
+
+       The arena is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_ARENA_H_DEFS
+#define ALLOCKIT_ARENA_H_DEFS
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_ARENA_CHUNK_SIZE
+#  define ALLOCKIT_ARENA_CHUNK_SIZE 65536
+#endif  /* !ALLOCKIT_ARENA_CHUNK_SIZE */
+
+typedef struct AkArenaChunk {
+  struct AkArenaChunk *next;
+  ALLOCKIT_SIZE_T size;
+} AkArenaChunk;
+
+typedef struct AkArenaMark {
+  AkArenaChunk *chunk;
+  unsigned char *top;
+} AkArenaMark;
+
+typedef struct AkArena {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  ALLOCKIT_SIZE_T chunk_size;
+  AkArenaChunk *first;
+  AkArenaChunk *chunk;
+  unsigned char *top;
+  unsigned char *end;
+  unsigned char *last;
+} AkArena;
+
+void ak_arena_init(AkArena *arena, AkAlloc *backing,
+                   ALLOCKIT_SIZE_T chunk_size);
+void ak_arena_reset(AkArena *arena);
+void ak_arena_deinit(AkArena *arena);
+
+AkArenaMark ak_arena_mark(AkArena *arena);
+void ak_arena_rollback(AkArena *arena, AkArenaMark mark);
+
+#endif  /* !ALLOCKIT_ARENA_H_DEFS */
+
+#ifdef ALLOCKIT_ARENA_IMPLEMENTATION
+#ifndef ALLOCKIT_ARENA_H_IMPL
+#define ALLOCKIT_ARENA_H_IMPL
+
+#include <stdint.h>
+
+static
+unsigned char *
+akArenaAlignUp(unsigned char *ptr, ALLOCKIT_SIZE_T align)
+{
+  return (unsigned char *)(((uintptr_t)ptr + (align - 1))
+                           & ~(uintptr_t)(align - 1));
+}
+
+static
+unsigned char *
+akArenaChunkData(AkArenaChunk *chunk)
+{
+  return (unsigned char *)(chunk + 1);
+}
+
+static
+void
+akArenaEnter(AkArena *arena, AkArenaChunk *chunk)
+{
+  arena->chunk = chunk;
+  arena->top = akArenaChunkData(chunk);
+  arena->end = akArenaChunkData(chunk) + chunk->size;
+}
+
+/* Moves the arena onto a chunk with at least `need` bytes of
+   space, reusing the next retained chunk if it is large enough and
+   otherwise inserting a fresh one after the current chunk. */
+static
+int
+akArenaGrow(AkArena *arena, ALLOCKIT_SIZE_T need)
+{
+  AkArenaChunk *next = arena->chunk ? arena->chunk->next : arena->first;
+  AkArenaChunk *chunk;
+  ALLOCKIT_SIZE_T size;
+
+  if (next && next->size >= need) {
+    akArenaEnter(arena, next);
+    return 1;
+  }
+
+  size = need > arena->chunk_size ? need : arena->chunk_size;
+  if (size > (ALLOCKIT_SIZE_T)-1 - sizeof(AkArenaChunk))
+    return 0;
+
+  chunk = ak_alloc_raw(arena->backing, sizeof(AkArenaChunk) + size,
+                       ALLOCKIT_ALIGNOF(AkArenaChunk), 1);
+  if (!chunk)
+    return 0;
+
+  chunk->size = size;
+  chunk->next = next;
+  if (arena->chunk)
+    arena->chunk->next = chunk;
+  else
+    arena->first = chunk;
+
+  akArenaEnter(arena, chunk);
+  return 1;
+}
+
+static
+void *
+akArenaAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+             ALLOCKIT_SIZE_T count)
+{
+  AkArena *arena = (AkArena *)alloc;
+  ALLOCKIT_SIZE_T bytes;
+  unsigned char *ptr;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  bytes = size * count;
+
+  ptr = akArenaAlignUp(arena->top, align);
+  if (!arena->chunk || ptr > arena->end
+      || bytes > (ALLOCKIT_SIZE_T)(arena->end - ptr)) {
+    if (bytes > (ALLOCKIT_SIZE_T)-1 - (align - 1))
+      return NULL;
+    if (!akArenaGrow(arena, bytes + (align - 1)))
+      return NULL;
+    ptr = akArenaAlignUp(arena->top, align);
+  }
+
+  arena->top = ptr + bytes;
+  arena->last = ptr;
+  return ptr;
+}
+
+static
+int
+akArenaResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+              ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkArena *arena = (AkArena *)alloc;
+  unsigned char *ptr = addr;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!ptr || ptr != arena->last)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+  if (size * count > (ALLOCKIT_SIZE_T)(arena->end - ptr))
+    return 0;
+
+  arena->top = ptr + size * count;
+  return 1;
+}
+
+static
+void
+akArenaFree(AkAlloc *alloc, void *addr)
+{
+  AkArena *arena = (AkArena *)alloc;
+
+  if (addr && addr == arena->last) {
+    arena->top = arena->last;
+    arena->last = NULL;
+  }
+}
+
+static
+void
+akArenaFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                 ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkArena *arena = (AkArena *)alloc;
+  unsigned char *ptr = addr;
+
+  (void)align;
+
+  if (ptr && ptr <= arena->top
+      && (ALLOCKIT_SIZE_T)(arena->top - ptr) == size * count) {
+    arena->top = ptr;
+    arena->last = NULL;
+  }
+}
+
+void
+ak_arena_init(AkArena *arena, AkAlloc *backing, ALLOCKIT_SIZE_T chunk_size)
+{
+  arena->alloc.alloc = akArenaAlloc;
+  arena->alloc.resize = akArenaResize;
+  arena->alloc.free = akArenaFree;
+  arena->alloc.free_sized = akArenaFreeSized;
+  arena->alloc.remap = NULL;
+  arena->alloc.alloc_ex = NULL;
+  arena->alloc.alloc_batch = NULL;
+  arena->alloc.free_batch = NULL;
+  arena->backing = backing;
+  arena->chunk_size = chunk_size ? chunk_size : ALLOCKIT_ARENA_CHUNK_SIZE;
+  arena->first = NULL;
+  arena->chunk = NULL;
+  arena->top = NULL;
+  arena->end = NULL;
+  arena->last = NULL;
+}
+
+void
+ak_arena_reset(AkArena *arena)
+{
+  arena->last = NULL;
+  if (arena->first) {
+    akArenaEnter(arena, arena->first);
+  } else {
+    arena->top = NULL;
+    arena->end = NULL;
+  }
+}
+
+AkArenaMark
+ak_arena_mark(AkArena *arena)
+{
+  AkArenaMark mark;
+
+  mark.chunk = arena->chunk;
+  mark.top = arena->top;
+  return mark;
+}
+
+void
+ak_arena_rollback(AkArena *arena, AkArenaMark mark)
+{
+  /* A mark taken before the first allocation rolls back to the start
+     of the arena, the same as a reset. */
+  if (!mark.chunk) {
+    ak_arena_reset(arena);
+    return;
+  }
+
+  arena->last = NULL;
+  arena->chunk = mark.chunk;
+  arena->top = mark.top;
+  arena->end = akArenaChunkData(mark.chunk) + mark.chunk->size;
+}
+
+void
+ak_arena_deinit(AkArena *arena)
+{
+  AkArenaChunk *chunk = arena->first;
+
+  while (chunk) {
+    AkArenaChunk *next = chunk->next;
+    ak_free(arena->backing, chunk);
+    chunk = next;
+  }
+
+  arena->first = NULL;
+  arena->chunk = NULL;
+  arena->top = NULL;
+  arena->end = NULL;
+  arena->last = NULL;
+}
+
+#endif  /* !ALLOCKIT_ARENA_H_IMPL */
+#endif  /* ALLOCKIT_ARENA_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,334 @@
+/* ak_atomic_pool.h - lock-free fixed-size object pool for AllocKit
+
+   FLAGS
+     ALLOCKIT_ATOMIC_POOL_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_atomic_pool.h to emit the implementation. The implementation
+       requires C11 atomics, and 64-bit atomics that are lock-free.
+
+   USAGE
+
+       An atomic pool is a fixed-size object pool, like the one in
+       ak_pool.h, whose get and put are lock-free: they may be called
+       from any thread at once without a mutex, and a thread that is
+       suspended in the middle of one never blocks the others.
+
+         #include "allockit.h"
+         #include "ak_atomic_pool.h"
+
+         AkAtomicPool pool = {0};
+         if (!ak_atomic_pool_init(&pool, backing, sizeof(Event),
+                                  ALLOCKIT_ALIGNOF(Event), 4096))
+           return -1;
+
+         Event *ev = ak_atomic_pool_get(&pool, Event);
+         ...
+         ak_atomic_pool_put(&pool, ev);
+
+       Unlike `AkPool`, the atomic pool never grows. `ak_atomic_pool_init`
+       takes every slot from the backing allocator up front, and
+       getting a slot fails once they are all in use, so the backing
+       allocator is never called afterwards and needn't be thread-safe.
+
+       Free slots are kept on a Treiber stack. Rather than a pointer,
+       the head of the stack holds the index of the top slot together
+       with a tag that is bumped by every push and pop, so a pop whose
+       top slot was taken and put back in the meantime (the ABA
+       problem) fails its compare-and-swap and retries instead of
+       corrupting the stack. Both fit in a single 64-bit word, so no
+       double-width compare-and-swap is needed; in exchange, a pool
+       holds fewer than 2^32 slots.
+
+       The pool can also be passed anywhere an `AkAlloc *` is
+       expected, and behaves like `AkPool` through that interface:
+       `alloc` fails for any request that is larger than a slot or
+       more strictly aligned than the pool, `resize` succeeds whenever
+       the new size still fits in a slot, and `ak_alloc_ex` reports
+       the whole slot as usable.
+
+         Event *ev = ak_alloc(&pool.alloc, Event, 1);
+
+       `ak_atomic_pool_deinit` returns the slots to the backing
+       allocator. No thread may use the pool while or after it is
+       called.
+
+         ak_atomic_pool_deinit(&pool);
+
+ */
+
+#ifndef ALLOCKIT_ATOMIC_POOL_H_DEFS
+#define ALLOCKIT_ATOMIC_POOL_H_DEFS
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "allockit.h"
+
+typedef struct AkAtomicPool {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  ALLOCKIT_SIZE_T size;
+  ALLOCKIT_SIZE_T align;
+  ALLOCKIT_SIZE_T count;
+  unsigned char *slots;
+  _Atomic uint64_t head;
+} AkAtomicPool;
+
+int ak_atomic_pool_init(AkAtomicPool *pool, AkAlloc *backing,
+                        ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                        ALLOCKIT_SIZE_T count);
+void ak_atomic_pool_deinit(AkAtomicPool *pool);
+
+void *ak_atomic_pool_get_raw(AkAtomicPool *pool);
+void ak_atomic_pool_put(AkAtomicPool *pool, void *addr);
+
+static inline
+void *
+ak_atomic_pool_get_sized(AkAtomicPool *pool, ALLOCKIT_SIZE_T size,
+                         ALLOCKIT_SIZE_T align)
+{
+  ALLOCKIT_ASSERT(size <= pool->size && align <= pool->align);
+  return ak_atomic_pool_get_raw(pool);
+}
+
+#define ak_atomic_pool_get(pPool, T) \
+  ((T *)ak_atomic_pool_get_sized(pPool, sizeof(T), ALLOCKIT_ALIGNOF(T)))
+
+#endif  /* !ALLOCKIT_ATOMIC_POOL_H_DEFS */
+
+#ifdef ALLOCKIT_ATOMIC_POOL_IMPLEMENTATION
+#ifndef ALLOCKIT_ATOMIC_POOL_H_IMPL
+#define ALLOCKIT_ATOMIC_POOL_H_IMPL
+
+/* The head packs the tag into the high 32 bits and the index of the
+   top slot plus one into the low 32 bits, with 0 meaning empty. Each
+   free slot holds the head's index for the slot below it. */
+#define ALLOCKIT_ATOMIC_POOL_INDEX(Head) ((uint32_t)(Head))
+#define ALLOCKIT_ATOMIC_POOL_HEAD(Tag, Index) \
+  ((uint64_t)(Tag) << 32 | (uint32_t)(Index))
+
+static
+_Atomic uint32_t *
+akAtomicPoolNext(AkAtomicPool *pool, uint32_t index)
+{
+  return (_Atomic uint32_t *)(pool->slots + (index - 1) * pool->size);
+}
+
+void *
+ak_atomic_pool_get_raw(AkAtomicPool *pool)
+{
+  uint64_t head, next_head;
+  uint32_t index, next;
+
+  head = atomic_load_explicit(&pool->head, memory_order_acquire);
+  do {
+    index = ALLOCKIT_ATOMIC_POOL_INDEX(head);
+    if (!index)
+      return NULL;
+
+    /* The slot may already have been taken by another thread, in
+       which case this reads garbage, but the slots are never
+       unmapped and the tag makes the exchange below fail. */
+    next = atomic_load_explicit(akAtomicPoolNext(pool, index),
+                                memory_order_relaxed);
+    next_head = ALLOCKIT_ATOMIC_POOL_HEAD((head >> 32) + 1, next);
+  } while (!atomic_compare_exchange_weak_explicit(&pool->head, &head,
+                                                  next_head,
+                                                  memory_order_acquire,
+                                                  memory_order_acquire));
+
+  return pool->slots + (index - 1) * pool->size;
+}
+
+void
+ak_atomic_pool_put(AkAtomicPool *pool, void *addr)
+{
+  uint64_t head, new_head;
+  uint32_t index;
+
+  if (!addr)
+    return;
+
+  index = (uint32_t)(((unsigned char *)addr - pool->slots) / pool->size) + 1;
+
+  head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+  do {
+    atomic_store_explicit(akAtomicPoolNext(pool, index),
+                          ALLOCKIT_ATOMIC_POOL_INDEX(head),
+                          memory_order_relaxed);
+    new_head = ALLOCKIT_ATOMIC_POOL_HEAD((head >> 32) + 1, index);
+  } while (!atomic_compare_exchange_weak_explicit(&pool->head, &head,
+                                                  new_head,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+static
+void *
+akAtomicPoolAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                    ALLOCKIT_SIZE_T *usable)
+{
+  AkAtomicPool *pool = (AkAtomicPool *)alloc;
+  void *slot;
+
+  if (count && size > pool->size / count)
+    return NULL;
+  if (align > pool->align)
+    return NULL;
+
+  slot = ak_atomic_pool_get_raw(pool);
+  if (slot)
+    *usable = pool->size;
+  return slot;
+}
+
+static
+void *
+akAtomicPoolAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                  ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akAtomicPoolAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akAtomicPoolResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkAtomicPool *pool = (AkAtomicPool *)alloc;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+
+  return !count || size <= pool->size / count;
+}
+
+static
+void
+akAtomicPoolFree(AkAlloc *alloc, void *addr)
+{
+  ak_atomic_pool_put((AkAtomicPool *)alloc, addr);
+}
+
+int
+ak_atomic_pool_init(AkAtomicPool *pool, AkAlloc *backing,
+                    ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                    ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T i;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (align < ALLOCKIT_ALIGNOF(uint32_t))
+    align = ALLOCKIT_ALIGNOF(uint32_t);
+  if (size < sizeof(uint32_t))
+    size = sizeof(uint32_t);
+  if (size > (ALLOCKIT_SIZE_T)-1 - (align - 1))
+    return 0;
+  size = (size + align - 1) & ~(align - 1);
+  if (!count || count >= UINT32_MAX)
+    return 0;
+  if (size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  pool->alloc.alloc = akAtomicPoolAlloc;
+  pool->alloc.resize = akAtomicPoolResize;
+  pool->alloc.free = akAtomicPoolFree;
+  pool->alloc.free_sized = NULL;
+  pool->alloc.remap = NULL;
+  pool->alloc.alloc_ex = akAtomicPoolAllocEx;
+  pool->alloc.alloc_batch = NULL;
+  pool->alloc.free_batch = NULL;
+  pool->backing = backing;
+  pool->size = size;
+  pool->align = align;
+  pool->count = count;
+
+  pool->slots = ak_alloc_raw(backing, size * count, align, 1);
+  if (!pool->slots)
+    return 0;
+
+  /* Thread the slots onto the stack so that they are handed out in
+     address order. */
+  for (i = 1; i < count; i++)
+    atomic_init(akAtomicPoolNext(pool, (uint32_t)i), (uint32_t)i + 1);
+  atomic_init(akAtomicPoolNext(pool, (uint32_t)count), 0);
+  atomic_init(&pool->head, ALLOCKIT_ATOMIC_POOL_HEAD(0, 1));
+
+  return 1;
+}
+
+void
+ak_atomic_pool_deinit(AkAtomicPool *pool)
+{
+  if (!pool->slots)
+    return;
+
+  ak_free_sized_raw(pool->backing, pool->slots, pool->size * pool->count,
+                    pool->align, 1);
+  pool->slots = NULL;
+  atomic_store(&pool->head, ALLOCKIT_ATOMIC_POOL_HEAD(0, 0));
+}
+
+#endif  /* !ALLOCKIT_ATOMIC_POOL_H_IMPL */
+#endif  /* ALLOCKIT_ATOMIC_POOL_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
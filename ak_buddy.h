@@ -0,0 +1,455 @@
+/* ak_buddy.h - binary buddy allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_BUDDY_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_buddy.h to emit the implementation.
+
+     ALLOCKIT_BUDDY_MIN_SIZE (default: 4096)
+       Size of the smallest block, which must be a power of two of at
+       least `2 * sizeof(void *)`.
+
+   USAGE
+
+       A buddy allocator manages a single power-of-two region, handing
+       out blocks whose sizes are powers of two. Each block is split
+       from a block twice its size, and its other half is its buddy:
+       when a block is freed and its buddy is free too, the two are
+       merged back into the larger block, and so on up, so that free
+       space doesn't stay fragmented over time.
+
+         #include "allockit.h"
+         #include "ak_page.h"
+         #include "ak_buddy.h"
+
+         AkBuddy buddy = {0};
+         if (!ak_buddy_init(&buddy, &ak_page_allocator, 64 << 20))
+           return -1;
+
+         void *buf = ak_alloc(&buddy.alloc, char, 300 << 10);
+
+       `ak_buddy_init` rounds the size up to a power of two, and takes
+       the whole region from the backing allocator up front, aligned
+       to its own size, along with a bitmap with one bit for every
+       block that could exist, marking which are free. It returns 0 if
+       either allocation fails. Once the region is exhausted, `alloc`
+       fails rather than asking the backing allocator for more.
+
+       Every allocation is rounded up to a power of two, of at least
+       ALLOCKIT_BUDDY_MIN_SIZE bytes, which also makes it aligned to
+       that size. Allocating and freeing each take time proportional
+       to the number of block sizes, which is logarithmic in the size
+       of the region. The allocator is intended for large buffers;
+       small objects waste most of their block.
+
+       `resize` shrinks a block in place by splitting off and freeing
+       its upper halves. It grows a block in place when the blocks
+       that it would be merged with are all free. `ak_alloc_ex`
+       reports the whole block as usable.
+
+       `ak_buddy_deinit` returns the region to the backing allocator.
+
+         ak_buddy_deinit(&buddy);
+
+       The buddy allocator is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_BUDDY_H_DEFS
+#define ALLOCKIT_BUDDY_H_DEFS
+
+#include <stdint.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_BUDDY_MIN_SIZE
+#  define ALLOCKIT_BUDDY_MIN_SIZE 4096
+#endif  /* !ALLOCKIT_BUDDY_MIN_SIZE */
+
+#define ALLOCKIT_BUDDY_ORDERS 48
+
+typedef struct AkBuddyBlock {
+  struct AkBuddyBlock *next;
+  struct AkBuddyBlock *prev;
+} AkBuddyBlock;
+
+typedef struct AkBuddy {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  unsigned char *base;
+  ALLOCKIT_SIZE_T size;
+  unsigned int orders;
+  uint64_t nonempty;
+  AkBuddyBlock *lists[ALLOCKIT_BUDDY_ORDERS];
+  unsigned char *free_bits;
+  unsigned char *block_orders;
+} AkBuddy;
+
+int ak_buddy_init(AkBuddy *buddy, AkAlloc *backing, ALLOCKIT_SIZE_T size);
+void ak_buddy_deinit(AkBuddy *buddy);
+
+#endif  /* !ALLOCKIT_BUDDY_H_DEFS */
+
+#ifdef ALLOCKIT_BUDDY_IMPLEMENTATION
+#ifndef ALLOCKIT_BUDDY_H_IMPL
+#define ALLOCKIT_BUDDY_H_IMPL
+
+/* Blocks of order k are ALLOCKIT_BUDDY_MIN_SIZE << k bytes. The
+   region has `orders` orders, with the whole region as the single
+   block of the highest one.
+
+   Each free block is on the list for its order and has its bit set in
+   `free_bits`, which holds the bits for every order one after the
+   other, starting from order 0. `block_orders` records the order of
+   each allocated block, indexed by its offset in units of the
+   smallest block. */
+
+static
+unsigned int
+akBuddyLowestBit(uint64_t bits)
+{
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctzll(bits);
+#else
+  unsigned int i = 0;
+
+  while (!(bits & 1)) {
+    bits >>= 1;
+    i++;
+  }
+  return i;
+#endif  /* __GNUC__ */
+}
+
+static
+ALLOCKIT_SIZE_T
+akBuddyBlockCount(AkBuddy *buddy)
+{
+  return buddy->size / ALLOCKIT_BUDDY_MIN_SIZE;
+}
+
+static
+ALLOCKIT_SIZE_T
+akBuddyBit(AkBuddy *buddy, unsigned int order, ALLOCKIT_SIZE_T offset)
+{
+  ALLOCKIT_SIZE_T blocks = akBuddyBlockCount(buddy);
+
+  return 2 * blocks - ((2 * blocks) >> order)
+         + offset / ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE << order);
+}
+
+static
+int
+akBuddyIsFree(AkBuddy *buddy, unsigned int order, ALLOCKIT_SIZE_T offset)
+{
+  ALLOCKIT_SIZE_T bit = akBuddyBit(buddy, order, offset);
+
+  return (buddy->free_bits[bit / 8] >> (bit % 8)) & 1;
+}
+
+static
+void
+akBuddyPush(AkBuddy *buddy, unsigned int order, ALLOCKIT_SIZE_T offset)
+{
+  AkBuddyBlock *block = (AkBuddyBlock *)(buddy->base + offset);
+  ALLOCKIT_SIZE_T bit = akBuddyBit(buddy, order, offset);
+
+  block->prev = NULL;
+  block->next = buddy->lists[order];
+  if (block->next)
+    block->next->prev = block;
+  buddy->lists[order] = block;
+  buddy->nonempty |= (uint64_t)1 << order;
+  buddy->free_bits[bit / 8] |= (unsigned char)(1u << (bit % 8));
+}
+
+static
+void
+akBuddyRemove(AkBuddy *buddy, unsigned int order, ALLOCKIT_SIZE_T offset)
+{
+  AkBuddyBlock *block = (AkBuddyBlock *)(buddy->base + offset);
+  ALLOCKIT_SIZE_T bit = akBuddyBit(buddy, order, offset);
+
+  if (block->prev)
+    block->prev->next = block->next;
+  else
+    buddy->lists[order] = block->next;
+  if (block->next)
+    block->next->prev = block->prev;
+  if (!buddy->lists[order])
+    buddy->nonempty &= ~((uint64_t)1 << order);
+  buddy->free_bits[bit / 8] &= (unsigned char)~(1u << (bit % 8));
+}
+
+/* Returns the order of the smallest block holding `bytes` bytes
+   aligned to `align`, or `orders` if there is none. */
+static
+unsigned int
+akBuddyOrderOf(AkBuddy *buddy, ALLOCKIT_SIZE_T bytes, ALLOCKIT_SIZE_T align)
+{
+  unsigned int order = 0;
+  ALLOCKIT_SIZE_T block = ALLOCKIT_BUDDY_MIN_SIZE;
+
+  while (order < buddy->orders && (block < bytes || block < align)) {
+    block <<= 1;
+    order++;
+  }
+  return order;
+}
+
+static
+void *
+akBuddyAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+               ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkBuddy *buddy = (AkBuddy *)alloc;
+  unsigned int order, found;
+  ALLOCKIT_SIZE_T offset;
+  uint64_t lists;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  order = akBuddyOrderOf(buddy, size * count, align);
+  if (order == buddy->orders)
+    return NULL;
+
+  lists = buddy->nonempty >> order;
+  if (!lists)
+    return NULL;
+  found = order + akBuddyLowestBit(lists);
+
+  offset = (ALLOCKIT_SIZE_T)((unsigned char *)buddy->lists[found]
+                             - buddy->base);
+  akBuddyRemove(buddy, found, offset);
+
+  /* Split the block down to the order wanted, freeing the upper
+     half each time. */
+  while (found > order) {
+    found--;
+    akBuddyPush(buddy, found,
+                offset + ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE << found));
+  }
+
+  buddy->block_orders[offset / ALLOCKIT_BUDDY_MIN_SIZE] =
+    (unsigned char)order;
+  *usable = (ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE << order;
+  return buddy->base + offset;
+}
+
+static
+void *
+akBuddyAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+             ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akBuddyAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akBuddyResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+              ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkBuddy *buddy = (AkBuddy *)alloc;
+  ALLOCKIT_SIZE_T offset;
+  unsigned int order, new_order, i;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  offset = (ALLOCKIT_SIZE_T)((unsigned char *)addr - buddy->base);
+  order = buddy->block_orders[offset / ALLOCKIT_BUDDY_MIN_SIZE];
+  new_order = akBuddyOrderOf(buddy, size * count, align);
+  if (new_order == buddy->orders)
+    return 0;
+
+  if (new_order < order) {
+    for (i = order; i > new_order; i--)
+      akBuddyPush(buddy, i - 1,
+                  offset + ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE
+                            << (i - 1)));
+  } else if (new_order > order) {
+    /* The block must be the lower half of each larger block, with
+       every upper half free. */
+    if (offset % ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE << new_order))
+      return 0;
+    for (i = order; i < new_order; i++)
+      if (!akBuddyIsFree(buddy, i,
+                         offset + ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE
+                                   << i)))
+        return 0;
+    for (i = order; i < new_order; i++)
+      akBuddyRemove(buddy, i,
+                    offset + ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE
+                              << i));
+  }
+
+  buddy->block_orders[offset / ALLOCKIT_BUDDY_MIN_SIZE] =
+    (unsigned char)new_order;
+  return 1;
+}
+
+static
+void
+akBuddyFree(AkAlloc *alloc, void *addr)
+{
+  AkBuddy *buddy = (AkBuddy *)alloc;
+  ALLOCKIT_SIZE_T offset, other;
+  unsigned int order;
+
+  if (!addr)
+    return;
+
+  offset = (ALLOCKIT_SIZE_T)((unsigned char *)addr - buddy->base);
+  order = buddy->block_orders[offset / ALLOCKIT_BUDDY_MIN_SIZE];
+
+  /* Merge with the buddy for as long as it is free. */
+  while (order + 1 < buddy->orders) {
+    other = offset ^ ((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE << order);
+    if (!akBuddyIsFree(buddy, order, other))
+      break;
+    akBuddyRemove(buddy, order, other);
+    offset &= ~((ALLOCKIT_SIZE_T)ALLOCKIT_BUDDY_MIN_SIZE << order);
+    order++;
+  }
+
+  akBuddyPush(buddy, order, offset);
+}
+
+int
+ak_buddy_init(AkBuddy *buddy, AkAlloc *backing, ALLOCKIT_SIZE_T size)
+{
+  ALLOCKIT_SIZE_T region = ALLOCKIT_BUDDY_MIN_SIZE;
+  ALLOCKIT_SIZE_T blocks, i;
+  unsigned int orders = 1;
+
+  ALLOCKIT_ASSERT((ALLOCKIT_BUDDY_MIN_SIZE & (ALLOCKIT_BUDDY_MIN_SIZE - 1))
+                  == 0);
+  ALLOCKIT_ASSERT(ALLOCKIT_BUDDY_MIN_SIZE >= sizeof(AkBuddyBlock));
+
+  while (region < size) {
+    if (region > (ALLOCKIT_SIZE_T)-1 / 2 || orders == ALLOCKIT_BUDDY_ORDERS)
+      return 0;
+    region <<= 1;
+    orders++;
+  }
+
+  buddy->alloc.alloc = akBuddyAlloc;
+  buddy->alloc.resize = akBuddyResize;
+  buddy->alloc.free = akBuddyFree;
+  buddy->alloc.free_sized = NULL;
+  buddy->alloc.remap = NULL;
+  buddy->alloc.alloc_ex = akBuddyAllocEx;
+  buddy->alloc.alloc_batch = NULL;
+  buddy->alloc.free_batch = NULL;
+  buddy->backing = backing;
+  buddy->size = region;
+  buddy->orders = orders;
+  buddy->nonempty = 0;
+  for (i = 0; i < ALLOCKIT_BUDDY_ORDERS; i++)
+    buddy->lists[i] = NULL;
+
+  /* One free bit for each of the 2 * blocks - 1 possible blocks,
+     followed by one order byte for each smallest block. */
+  blocks = akBuddyBlockCount(buddy);
+  buddy->free_bits = ak_alloc(backing, unsigned char,
+                              (2 * blocks + 7) / 8 + blocks);
+  if (!buddy->free_bits)
+    return 0;
+  buddy->block_orders = buddy->free_bits + (2 * blocks + 7) / 8;
+  for (i = 0; i < (2 * blocks + 7) / 8; i++)
+    buddy->free_bits[i] = 0;
+
+  buddy->base = ak_alloc_raw(backing, region, region, 1);
+  if (!buddy->base) {
+    ak_free_sized(backing, buddy->free_bits, unsigned char,
+                  (2 * blocks + 7) / 8 + blocks);
+    buddy->free_bits = NULL;
+    return 0;
+  }
+
+  akBuddyPush(buddy, orders - 1, 0);
+  return 1;
+}
+
+void
+ak_buddy_deinit(AkBuddy *buddy)
+{
+  ALLOCKIT_SIZE_T blocks = akBuddyBlockCount(buddy);
+
+  if (!buddy->base)
+    return;
+
+  ak_free_sized_raw(buddy->backing, buddy->base, buddy->size, buddy->size, 1);
+  ak_free_sized(buddy->backing, buddy->free_bits, unsigned char,
+                (2 * blocks + 7) / 8 + blocks);
+  buddy->base = NULL;
+  buddy->free_bits = NULL;
+  buddy->block_orders = NULL;
+}
+
+#endif  /* !ALLOCKIT_BUDDY_H_IMPL */
+#endif  /* ALLOCKIT_BUDDY_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
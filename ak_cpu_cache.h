@@ -0,0 +1,852 @@
+/* ak_cpu_cache.h - per-CPU caching front-end for AllocKit
+
+   FLAGS
+     ALLOCKIT_CPU_CACHE_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_cpu_cache.h to emit the implementation. The implementation
+       requires C11 atomics and Linux, and must be compiled with
+       _GNU_SOURCE defined.
+
+     ALLOCKIT_CPU_CACHE_NO_RSEQ
+       Define this to never use the thread's restartable sequence area
+       registered by glibc: the current CPU is always found with
+       `sched_getcpu`, and each CPU's magazines are always guarded by
+       a lock.
+
+     ALLOCKIT_CPU_CACHE_MAGAZINE (default: 64)
+       Number of blocks each CPU may hold per size class.
+
+   USAGE
+
+       A CPU cache works like the thread cache in ak_thread_cache.h,
+       but keeps its magazines per CPU rather than per thread, so the
+       memory held in them scales with the number of cores instead of
+       the number of threads.
+
+         #include "allockit.h"
+         #include "ak_cpu_cache.h"
+
+         AkCpuCache cache = {0};
+         if (!ak_cpu_cache_init(&cache, locked_backing))
+           return -1;
+
+         do_work_on_thousands_of_threads(&cache.alloc);
+
+       The current CPU is read from the `cpu_id` field of the thread's
+       rseq (restartable sequence) area, which the kernel keeps up to
+       date and which costs a single load. On kernels or C libraries
+       without rseq support, `sched_getcpu` is used instead.
+
+       Since a thread may be migrated or preempted at any time, on
+       x86-64 and aarch64 each pop from or push to a magazine is a
+       restartable sequence: a few instructions that check the thread
+       is still on the magazine's CPU and commit with a single store
+       to its count, which the kernel restarts if the thread is
+       preempted, migrated or signalled before that store. The fast
+       path takes no lock and makes no atomic read-modify-write.
+       Refills and flushes move blocks one sequence at a time, and a
+       thread on a CPU numbered beyond `sysconf(_SC_NPROCESSORS_CONF)`
+       goes straight to the backing allocator.
+
+       Elsewhere, or without rseq, each CPU's magazines are guarded by
+       a spinlock that is almost never contended. The lock is only
+       ever tried once: if it is held, the request goes straight to
+       the backing allocator instead of spinning on a lock whose
+       holder may not be running.
+
+       As with the thread cache, only allocations of up to
+       ALLOCKIT_CPU_CACHE_MAX_SIZE (1024) bytes, aligned to at most
+       ALLOCKIT_CPU_CACHE_ALIGN (16) bytes, are cached. Everything
+       else is passed through to the backing allocator, which must be
+       thread-safe. Every block carries the same 16-byte header
+       recording its size class, so `free` and `ak_free_sized` both
+       return cached blocks to a magazine, `resize` succeeds for a
+       cached block whenever the new size still fits in its class,
+       and `ak_alloc_ex` reports the size of the class as usable.
+
+       `ak_cpu_cache_deinit` flushes every magazine back to the
+       backing allocator. No thread may use the cache while or after
+       it is called.
+
+         ak_cpu_cache_deinit(&cache);
+
+ */
+
+#ifndef ALLOCKIT_CPU_CACHE_H_DEFS
+#define ALLOCKIT_CPU_CACHE_H_DEFS
+
+#include <stdatomic.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_CPU_CACHE_MAGAZINE
+#  define ALLOCKIT_CPU_CACHE_MAGAZINE 64
+#endif  /* !ALLOCKIT_CPU_CACHE_MAGAZINE */
+
+#define ALLOCKIT_CPU_CACHE_CLASSES 20
+#define ALLOCKIT_CPU_CACHE_MAX_SIZE 1024
+#define ALLOCKIT_CPU_CACHE_ALIGN 16
+
+typedef struct AkCpuCacheMagazine {
+  ALLOCKIT_SIZE_T count;
+  void *blocks[ALLOCKIT_CPU_CACHE_MAGAZINE];
+} AkCpuCacheMagazine;
+
+typedef struct AkCpuCacheSlot {
+  _Alignas(64) atomic_flag lock;
+  AkCpuCacheMagazine magazines[ALLOCKIT_CPU_CACHE_CLASSES];
+} AkCpuCacheSlot;
+
+typedef struct AkCpuCache {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  AkCpuCacheSlot *slots;
+  unsigned int cpus;
+  int rseq;
+} AkCpuCache;
+
+int ak_cpu_cache_init(AkCpuCache *cache, AkAlloc *backing);
+void ak_cpu_cache_deinit(AkCpuCache *cache);
+
+#endif  /* !ALLOCKIT_CPU_CACHE_H_DEFS */
+
+#ifdef ALLOCKIT_CPU_CACHE_IMPLEMENTATION
+#ifndef ALLOCKIT_CPU_CACHE_H_IMPL
+#define ALLOCKIT_CPU_CACHE_H_IMPL
+
+#include <sched.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#if !defined(ALLOCKIT_CPU_CACHE_NO_RSEQ) && defined(__has_include)
+#  if __has_include(<sys/rseq.h>)
+#    include <sys/rseq.h>
+#    define ALLOCKIT_CPU_CACHE_RSEQ
+#  endif  /* __has_include(<sys/rseq.h>) */
+#endif  /* !ALLOCKIT_CPU_CACHE_NO_RSEQ && __has_include */
+
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ
+#  if defined(__x86_64__) || defined(__aarch64__)
+#    define ALLOCKIT_CPU_CACHE_RSEQ_CS
+#  endif  /* __x86_64__ || __aarch64__ */
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ */
+
+static const unsigned short
+akCpuCacheClassSize[ALLOCKIT_CPU_CACHE_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024
+};
+
+/* Indexed by (bytes + 15) >> 4. */
+static const unsigned char akCpuCacheClassIndex[] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11,
+  11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+  15, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17,
+  17, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19,
+  19
+};
+
+/* Returns the size class for an allocation, or -1 if it is passed
+   through to the backing allocator. */
+static
+int
+akCpuCacheClassOf(ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                  ALLOCKIT_SIZE_T count)
+{
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return -1;
+  if (size * count > ALLOCKIT_CPU_CACHE_MAX_SIZE
+      || align > ALLOCKIT_CPU_CACHE_ALIGN)
+    return -1;
+
+  return akCpuCacheClassIndex[(size * count + 15) >> 4];
+}
+
+/* Precedes every block handed out, at ALLOCKIT_CPU_CACHE_ALIGN bytes
+   before it. `cls` is the size class of a cached block, or
+   ALLOCKIT_CPU_CACHE_CLASSES for a block passed through to the
+   backing allocator, whose allocation starts `offset` bytes before
+   the block. Magazines hold the start of each cached allocation,
+   where its header is. */
+typedef struct AkCpuCacheHeader {
+  ALLOCKIT_SIZE_T cls;
+  ALLOCKIT_SIZE_T offset;
+} AkCpuCacheHeader;
+
+static
+AkCpuCacheHeader *
+akCpuCacheHeaderOf(void *addr)
+{
+  return (AkCpuCacheHeader *)((unsigned char *)addr
+                              - ALLOCKIT_CPU_CACHE_ALIGN);
+}
+
+static
+void
+akCpuCacheInitHeader(void *base, int cls)
+{
+  AkCpuCacheHeader *header = base;
+
+  header->cls = (ALLOCKIT_SIZE_T)cls;
+  header->offset = ALLOCKIT_CPU_CACHE_ALIGN;
+}
+
+static
+void *
+akCpuCacheAllocBlock(AkCpuCache *cache, int cls)
+{
+  void *base = ak_alloc_raw(cache->backing,
+                            akCpuCacheClassSize[cls]
+                            + ALLOCKIT_CPU_CACHE_ALIGN,
+                            ALLOCKIT_CPU_CACHE_ALIGN, 1);
+
+  if (base)
+    akCpuCacheInitHeader(base, cls);
+  return base;
+}
+
+static
+void
+akCpuCacheFreeBlocks(AkCpuCache *cache, int cls, void **blocks,
+                     ALLOCKIT_SIZE_T n)
+{
+  ak_free_batch_raw(cache->backing, blocks, n,
+                    akCpuCacheClassSize[cls] + ALLOCKIT_CPU_CACHE_ALIGN,
+                    ALLOCKIT_CPU_CACHE_ALIGN, 1);
+}
+
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ
+
+static
+struct rseq *
+akCpuCacheRseqArea(void)
+{
+  return (struct rseq *)((char *)__builtin_thread_pointer()
+                         + __rseq_offset);
+}
+
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ */
+
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ_CS
+
+_Static_assert(sizeof(ALLOCKIT_SIZE_T) == 8 && sizeof(void *) == 8,
+               "the rseq sequences move 64-bit counts and pointers");
+
+#define ALLOCKIT_CPU_CACHE_STR_(x) #x
+#define ALLOCKIT_CPU_CACHE_STR(x) ALLOCKIT_CPU_CACHE_STR_(x)
+
+/* Both sequences run from label 1 to the commit at label 2, and are
+   described to the kernel by the rseq_cs at label 3, whose address
+   they store in the thread's rseq area first. If the thread is
+   preempted, migrated or signalled in between, the kernel resumes it
+   at label 4, which must follow the signature glibc registered, and
+   which jumps to `aborted`. */
+#define ALLOCKIT_CPU_CACHE_RSEQ_DESCRIPTOR                              \
+  ".pushsection __rseq_cs, \"aw\"\n"                                   \
+  ".balign 32\n"                                                        \
+  "3:\n"                                                                \
+  ".long 0, 0\n"                                                        \
+  ".quad 1f, 2f - 1f, 4f\n"                                             \
+  ".popsection\n"
+
+#ifdef __x86_64__
+#  define ALLOCKIT_CPU_CACHE_RSEQ_ABORT                                 \
+  ".pushsection __rseq_failure, \"ax\"\n"                              \
+  ".byte 0x0f, 0xb9, 0x3d\n"                                            \
+  ".long " ALLOCKIT_CPU_CACHE_STR(RSEQ_SIG) "\n"                        \
+  "4:\n"                                                                \
+  "jmp %l[aborted]\n"                                                   \
+  ".popsection\n"
+#else
+#  define ALLOCKIT_CPU_CACHE_RSEQ_ABORT                                 \
+  ".pushsection __rseq_failure, \"ax\"\n"                              \
+  ".inst " ALLOCKIT_CPU_CACHE_STR(RSEQ_SIG_CODE) "\n"                   \
+  "4:\n"                                                                \
+  "b %l[aborted]\n"                                                     \
+  ".popsection\n"
+#endif  /* __x86_64__ */
+
+/* Pops the last block of `mag`, which belongs to `cpu`, into
+   `*block`. Returns 1 if a block was popped, 0 if `mag` is empty, or
+   -1 if the thread was moved off `cpu` or interrupted, and nothing
+   was popped. */
+static
+int
+akCpuCacheRseqPop(struct rseq *rs, uint32_t cpu, AkCpuCacheMagazine *mag,
+                  void **block)
+{
+#ifdef __x86_64__
+  __asm__ goto (
+    ALLOCKIT_CPU_CACHE_RSEQ_DESCRIPTOR
+    "leaq 3b(%%rip), %%rax\n"
+    "movq %%rax, (%[cs])\n"
+    "1:\n"
+    "cmpl %[cpu], (%[cpu_id])\n"
+    "jnz %l[aborted]\n"
+    "movq (%[count]), %%rax\n"
+    "testq %%rax, %%rax\n"
+    "jz %l[empty]\n"
+    "movq -8(%[blocks], %%rax, 8), %%rdx\n"
+    "movq %%rdx, (%[block])\n"
+    "decq %%rax\n"
+    "movq %%rax, (%[count])\n"
+    "2:\n"
+    ALLOCKIT_CPU_CACHE_RSEQ_ABORT
+    :
+    : [cs] "r" (&rs->rseq_cs), [cpu_id] "r" (&rs->cpu_id), [cpu] "r" (cpu),
+      [count] "r" (&mag->count), [blocks] "r" (mag->blocks),
+      [block] "r" (block)
+    : "rax", "rdx", "memory", "cc"
+    : empty, aborted);
+#else
+  __asm__ goto (
+    ALLOCKIT_CPU_CACHE_RSEQ_DESCRIPTOR
+    "adrp x9, 3b\n"
+    "add x9, x9, :lo12:3b\n"
+    "str x9, [%[cs]]\n"
+    "1:\n"
+    "ldr w9, [%[cpu_id]]\n"
+    "cmp w9, %w[cpu]\n"
+    "b.ne %l[aborted]\n"
+    "ldr x10, [%[count]]\n"
+    "cbz x10, %l[empty]\n"
+    "sub x10, x10, #1\n"
+    "ldr x11, [%[blocks], x10, lsl #3]\n"
+    "str x11, [%[block]]\n"
+    "str x10, [%[count]]\n"
+    "2:\n"
+    ALLOCKIT_CPU_CACHE_RSEQ_ABORT
+    :
+    : [cs] "r" (&rs->rseq_cs), [cpu_id] "r" (&rs->cpu_id), [cpu] "r" (cpu),
+      [count] "r" (&mag->count), [blocks] "r" (mag->blocks),
+      [block] "r" (block)
+    : "x9", "x10", "x11", "memory", "cc"
+    : empty, aborted);
+#endif  /* __x86_64__ */
+  return 1;
+empty:
+  return 0;
+aborted:
+  return -1;
+}
+
+/* Pushes `block` onto `mag`, which belongs to `cpu`. Returns 1 if it
+   was pushed, 0 if `mag` is full, or -1 if the thread was moved off
+   `cpu` or interrupted, and nothing was pushed. */
+static
+int
+akCpuCacheRseqPush(struct rseq *rs, uint32_t cpu, AkCpuCacheMagazine *mag,
+                   void *block)
+{
+#ifdef __x86_64__
+  __asm__ goto (
+    ALLOCKIT_CPU_CACHE_RSEQ_DESCRIPTOR
+    "leaq 3b(%%rip), %%rax\n"
+    "movq %%rax, (%[cs])\n"
+    "1:\n"
+    "cmpl %[cpu], (%[cpu_id])\n"
+    "jnz %l[aborted]\n"
+    "movq (%[count]), %%rax\n"
+    "cmpq %[max], %%rax\n"
+    "jae %l[full]\n"
+    "movq %[block], (%[blocks], %%rax, 8)\n"
+    "incq %%rax\n"
+    "movq %%rax, (%[count])\n"
+    "2:\n"
+    ALLOCKIT_CPU_CACHE_RSEQ_ABORT
+    :
+    : [cs] "r" (&rs->rseq_cs), [cpu_id] "r" (&rs->cpu_id), [cpu] "r" (cpu),
+      [count] "r" (&mag->count), [blocks] "r" (mag->blocks),
+      [block] "r" (block),
+      [max] "r" ((ALLOCKIT_SIZE_T)ALLOCKIT_CPU_CACHE_MAGAZINE)
+    : "rax", "memory", "cc"
+    : full, aborted);
+#else
+  __asm__ goto (
+    ALLOCKIT_CPU_CACHE_RSEQ_DESCRIPTOR
+    "adrp x9, 3b\n"
+    "add x9, x9, :lo12:3b\n"
+    "str x9, [%[cs]]\n"
+    "1:\n"
+    "ldr w9, [%[cpu_id]]\n"
+    "cmp w9, %w[cpu]\n"
+    "b.ne %l[aborted]\n"
+    "ldr x10, [%[count]]\n"
+    "cmp x10, %[max]\n"
+    "b.hs %l[full]\n"
+    "str %[block], [%[blocks], x10, lsl #3]\n"
+    "add x10, x10, #1\n"
+    "str x10, [%[count]]\n"
+    "2:\n"
+    ALLOCKIT_CPU_CACHE_RSEQ_ABORT
+    :
+    : [cs] "r" (&rs->rseq_cs), [cpu_id] "r" (&rs->cpu_id), [cpu] "r" (cpu),
+      [count] "r" (&mag->count), [blocks] "r" (mag->blocks),
+      [block] "r" (block),
+      [max] "r" ((ALLOCKIT_SIZE_T)ALLOCKIT_CPU_CACHE_MAGAZINE)
+    : "x9", "x10", "memory", "cc"
+    : full, aborted);
+#endif  /* __x86_64__ */
+  return 1;
+full:
+  return 0;
+aborted:
+  return -1;
+}
+
+/* Pops a block of class `cls` from the current CPU's magazine into
+   `*base`. Returns 1 if a block was popped, 0 if the magazine is
+   empty, or -1 if the current CPU has no slot. */
+static
+int
+akCpuCacheRseqTake(AkCpuCache *cache, int cls, void **base)
+{
+  struct rseq *rs = akCpuCacheRseqArea();
+  uint32_t cpu;
+  int popped;
+
+  do {
+    cpu = *(volatile uint32_t *)&rs->cpu_id;
+    if (cpu >= cache->cpus)
+      return -1;
+    popped = akCpuCacheRseqPop(rs, cpu, &cache->slots[cpu].magazines[cls],
+                               base);
+  } while (popped < 0);
+
+  return popped;
+}
+
+/* Pushes `base`, of class `cls`, onto the current CPU's magazine.
+   Returns 1 if it was pushed, 0 if the magazine is full, or -1 if the
+   current CPU has no slot. */
+static
+int
+akCpuCacheRseqGive(AkCpuCache *cache, int cls, void *base)
+{
+  struct rseq *rs = akCpuCacheRseqArea();
+  uint32_t cpu;
+  int pushed;
+
+  do {
+    cpu = *(volatile uint32_t *)&rs->cpu_id;
+    if (cpu >= cache->cpus)
+      return -1;
+    pushed = akCpuCacheRseqPush(rs, cpu, &cache->slots[cpu].magazines[cls],
+                                base);
+  } while (pushed < 0);
+
+  return pushed;
+}
+
+static
+void *
+akCpuCacheRseqAlloc(AkCpuCache *cache, int cls)
+{
+  void *blocks[ALLOCKIT_CPU_CACHE_MAGAZINE / 2];
+  ALLOCKIT_SIZE_T n, i;
+  int taken = akCpuCacheRseqTake(cache, cls, &blocks[0]);
+
+  if (taken > 0)
+    return blocks[0];
+  if (taken < 0)
+    return akCpuCacheAllocBlock(cache, cls);
+
+  n = ak_alloc_batch_raw(cache->backing,
+                         akCpuCacheClassSize[cls] + ALLOCKIT_CPU_CACHE_ALIGN,
+                         ALLOCKIT_CPU_CACHE_ALIGN, 1, blocks,
+                         ALLOCKIT_CPU_CACHE_MAGAZINE / 2);
+  if (!n)
+    return NULL;
+
+  for (i = 0; i < n; i++)
+    akCpuCacheInitHeader(blocks[i], cls);
+
+  /* Other threads may have refilled the magazine meanwhile, or this
+     one may have moved to another CPU, so whatever doesn't fit goes
+     straight back. */
+  for (i = 1; i < n && akCpuCacheRseqGive(cache, cls, blocks[i]) > 0; i++)
+    ;
+  if (i < n)
+    akCpuCacheFreeBlocks(cache, cls, blocks + i, n - i);
+
+  return blocks[0];
+}
+
+static
+void
+akCpuCacheRseqPut(AkCpuCache *cache, void *base, int cls)
+{
+  void *blocks[ALLOCKIT_CPU_CACHE_MAGAZINE / 2];
+  ALLOCKIT_SIZE_T n;
+  int given;
+
+  while ((given = akCpuCacheRseqGive(cache, cls, base)) == 0) {
+    for (n = 0; n < ALLOCKIT_CPU_CACHE_MAGAZINE / 2
+                && akCpuCacheRseqTake(cache, cls, &blocks[n]) > 0; n++)
+      ;
+    if (!n)
+      break;
+    akCpuCacheFreeBlocks(cache, cls, blocks, n);
+  }
+
+  if (given <= 0)
+    akCpuCacheFreeBlocks(cache, cls, &base, 1);
+}
+
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ_CS */
+
+static
+unsigned int
+akCpuCacheCurrentCpu(void)
+{
+  int cpu;
+
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ
+  if (__rseq_size) {
+    struct rseq *rs = akCpuCacheRseqArea();
+    int32_t id = (int32_t)*(volatile uint32_t *)&rs->cpu_id;
+
+    if (id >= 0)
+      return (unsigned int)id;
+  }
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ */
+
+  cpu = sched_getcpu();
+  return cpu < 0 ? 0 : (unsigned int)cpu;
+}
+
+/* Returns the current CPU's slot locked, or NULL if it is busy. Only
+   used without restartable sequences. */
+static
+AkCpuCacheSlot *
+akCpuCacheLock(AkCpuCache *cache)
+{
+  AkCpuCacheSlot *slot = &cache->slots[akCpuCacheCurrentCpu()
+                                       % cache->cpus];
+
+  if (atomic_flag_test_and_set_explicit(&slot->lock, memory_order_acquire))
+    return NULL;
+  return slot;
+}
+
+static
+void
+akCpuCacheUnlock(AkCpuCacheSlot *slot)
+{
+  atomic_flag_clear_explicit(&slot->lock, memory_order_release);
+}
+
+static
+void *
+akCpuCacheLockedAlloc(AkCpuCache *cache, int cls)
+{
+  AkCpuCacheSlot *slot = akCpuCacheLock(cache);
+  AkCpuCacheMagazine *mag;
+  void *block = NULL;
+  ALLOCKIT_SIZE_T i;
+
+  if (!slot)
+    return akCpuCacheAllocBlock(cache, cls);
+
+  mag = &slot->magazines[cls];
+  if (!mag->count) {
+    mag->count = ak_alloc_batch_raw(cache->backing,
+                                    akCpuCacheClassSize[cls]
+                                    + ALLOCKIT_CPU_CACHE_ALIGN,
+                                    ALLOCKIT_CPU_CACHE_ALIGN, 1,
+                                    mag->blocks,
+                                    ALLOCKIT_CPU_CACHE_MAGAZINE / 2);
+    for (i = 0; i < mag->count; i++)
+      akCpuCacheInitHeader(mag->blocks[i], cls);
+  }
+  if (mag->count)
+    block = mag->blocks[--mag->count];
+  akCpuCacheUnlock(slot);
+  return block;
+}
+
+static
+void
+akCpuCacheLockedPut(AkCpuCache *cache, void *base, int cls)
+{
+  AkCpuCacheSlot *slot = akCpuCacheLock(cache);
+  AkCpuCacheMagazine *mag;
+
+  if (!slot) {
+    akCpuCacheFreeBlocks(cache, cls, &base, 1);
+    return;
+  }
+
+  mag = &slot->magazines[cls];
+  if (mag->count == ALLOCKIT_CPU_CACHE_MAGAZINE) {
+    mag->count -= ALLOCKIT_CPU_CACHE_MAGAZINE / 2;
+    akCpuCacheFreeBlocks(cache, cls, mag->blocks + mag->count,
+                         ALLOCKIT_CPU_CACHE_MAGAZINE / 2);
+  }
+
+  mag->blocks[mag->count++] = base;
+  akCpuCacheUnlock(slot);
+}
+
+static
+void *
+akCpuCacheAllocLarge(AkCpuCache *cache, ALLOCKIT_SIZE_T size,
+                     ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                     ALLOCKIT_SIZE_T *usable)
+{
+  ALLOCKIT_SIZE_T offset = align > ALLOCKIT_CPU_CACHE_ALIGN
+                           ? align : ALLOCKIT_CPU_CACHE_ALIGN;
+  AkCpuCacheHeader *header;
+  unsigned char *base;
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - offset)
+    return NULL;
+
+  base = ak_alloc_ex_raw(cache->backing, size * count + offset, offset, 1,
+                         usable);
+  if (!base)
+    return NULL;
+
+  header = akCpuCacheHeaderOf(base + offset);
+  header->cls = ALLOCKIT_CPU_CACHE_CLASSES;
+  header->offset = offset;
+  *usable -= offset;
+  return base + offset;
+}
+
+static
+void *
+akCpuCacheAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                  ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                  ALLOCKIT_SIZE_T *usable)
+{
+  AkCpuCache *cache = (AkCpuCache *)alloc;
+  unsigned char *block;
+  int cls = akCpuCacheClassOf(size, align, count);
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (cls < 0)
+    return akCpuCacheAllocLarge(cache, size, align, count, usable);
+
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ_CS
+  if (cache->rseq)
+    block = akCpuCacheRseqAlloc(cache, cls);
+  else
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ_CS */
+    block = akCpuCacheLockedAlloc(cache, cls);
+
+  if (!block)
+    return NULL;
+  *usable = akCpuCacheClassSize[cls];
+  return block + ALLOCKIT_CPU_CACHE_ALIGN;
+}
+
+static
+void *
+akCpuCacheAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akCpuCacheAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akCpuCacheResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                 ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkCpuCache *cache = (AkCpuCache *)alloc;
+  AkCpuCacheHeader *header;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  /* Cached blocks keep their class, so that they can be flushed back
+     with its size. */
+  header = akCpuCacheHeaderOf(addr);
+  if (header->cls < ALLOCKIT_CPU_CACHE_CLASSES)
+    return size * count <= akCpuCacheClassSize[header->cls];
+
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - header->offset)
+    return 0;
+  return ak_resize_raw(cache->backing,
+                       (unsigned char *)addr - header->offset,
+                       size * count + header->offset, header->offset, 1);
+}
+
+/* Returns the cached allocation starting at `base`, of size class
+   `cls`, to the current CPU's magazine. */
+static
+void
+akCpuCachePut(AkCpuCache *cache, void *base, ALLOCKIT_SIZE_T cls)
+{
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ_CS
+  if (cache->rseq) {
+    akCpuCacheRseqPut(cache, base, (int)cls);
+    return;
+  }
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ_CS */
+
+  akCpuCacheLockedPut(cache, base, (int)cls);
+}
+
+static
+void
+akCpuCacheFree(AkAlloc *alloc, void *addr)
+{
+  AkCpuCache *cache = (AkCpuCache *)alloc;
+  AkCpuCacheHeader *header;
+
+  if (!addr)
+    return;
+
+  header = akCpuCacheHeaderOf(addr);
+  if (header->cls < ALLOCKIT_CPU_CACHE_CLASSES)
+    akCpuCachePut(cache, header, header->cls);
+  else
+    ak_free(cache->backing, (unsigned char *)addr - header->offset);
+}
+
+static
+void
+akCpuCacheFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkCpuCache *cache = (AkCpuCache *)alloc;
+  AkCpuCacheHeader *header;
+
+  (void)align;
+
+  if (!addr)
+    return;
+
+  header = akCpuCacheHeaderOf(addr);
+  if (header->cls < ALLOCKIT_CPU_CACHE_CLASSES)
+    akCpuCachePut(cache, header, header->cls);
+  else
+    ak_free_sized_raw(cache->backing,
+                      (unsigned char *)addr - header->offset,
+                      size * count + header->offset, header->offset, 1);
+}
+
+int
+ak_cpu_cache_init(AkCpuCache *cache, AkAlloc *backing)
+{
+  long cpus = sysconf(_SC_NPROCESSORS_CONF);
+  unsigned int i, j;
+
+  cache->alloc.alloc = akCpuCacheAlloc;
+  cache->alloc.resize = akCpuCacheResize;
+  cache->alloc.free = akCpuCacheFree;
+  cache->alloc.free_sized = akCpuCacheFreeSized;
+  cache->alloc.remap = NULL;
+  cache->alloc.alloc_ex = akCpuCacheAllocEx;
+  cache->alloc.alloc_batch = NULL;
+  cache->alloc.free_batch = NULL;
+  cache->backing = backing;
+  cache->cpus = cpus > 0 ? (unsigned int)cpus : 1;
+  cache->rseq = 0;
+#ifdef ALLOCKIT_CPU_CACHE_RSEQ_CS
+  cache->rseq = __rseq_size > 0;
+#endif  /* ALLOCKIT_CPU_CACHE_RSEQ_CS */
+
+  cache->slots = ak_alloc(backing, AkCpuCacheSlot, cache->cpus);
+  if (!cache->slots)
+    return 0;
+
+  for (i = 0; i < cache->cpus; i++) {
+    atomic_flag_clear(&cache->slots[i].lock);
+    for (j = 0; j < ALLOCKIT_CPU_CACHE_CLASSES; j++)
+      cache->slots[i].magazines[j].count = 0;
+  }
+
+  return 1;
+}
+
+void
+ak_cpu_cache_deinit(AkCpuCache *cache)
+{
+  unsigned int i, j;
+
+  if (!cache->slots)
+    return;
+
+  for (i = 0; i < cache->cpus; i++) {
+    for (j = 0; j < ALLOCKIT_CPU_CACHE_CLASSES; j++) {
+      AkCpuCacheMagazine *mag = &cache->slots[i].magazines[j];
+
+      akCpuCacheFreeBlocks(cache, (int)j, mag->blocks, mag->count);
+      mag->count = 0;
+    }
+  }
+
+  ak_free_sized(cache->backing, cache->slots, AkCpuCacheSlot, cache->cpus);
+  cache->slots = NULL;
+}
+
+#endif  /* !ALLOCKIT_CPU_CACHE_H_IMPL */
+#endif  /* ALLOCKIT_CPU_CACHE_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
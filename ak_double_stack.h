@@ -0,0 +1,267 @@
+/* ak_double_stack.h - double-ended stack allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_DOUBLE_STACK_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_double_stack.h to emit the implementation. The low side is
+       a fixed buffer from ak_fixed_buffer.h, so
+       ALLOCKIT_FIXED_BUFFER_IMPLEMENTATION must also be defined in
+       exactly one source file.
+
+   USAGE
+
+       A double-ended stack serves allocations out of a single region
+       supplied by the caller, like the fixed buffer allocator in
+       ak_fixed_buffer.h, but from both ends at once. It exposes two
+       allocators: `low` bumps upwards from the start of the region,
+       and `high` bumps downwards from its end. The region is only
+       exhausted when the two meet, so neither side needs a fixed share
+       of it up front.
+
+         #include "allockit.h"
+         #include "ak_double_stack.h"
+
+         AkDoubleStack ds = {0};
+         ak_double_stack_init(&ds, region, region_size);
+
+       The usual split is to keep long-lived data on the low side and
+       temporaries on the high side, resetting the high side between
+       phases with `ak_double_stack_reset_high`, which leaves the low
+       side untouched.
+
+         for (i = 0; i < level_count; i++) {
+           Mesh *meshes = load_meshes(&ds.low.alloc, &ds.high.alloc, i);
+           ...
+           ak_double_stack_reset_high(&ds);
+         }
+
+       The low side is an `AkFixedBuffer` whose end is the top of the
+       high side, and the high side behaves like one: `alloc` returns
+       NULL once the sides meet, `free` releases the side's most
+       recent allocation and is otherwise a no-op, and `ak_free_sized`
+       releases any allocation at the side's top, so allocations freed
+       in reverse order are all reclaimed. `resize` succeeds only for
+       the side's most recent allocation. On the low side, it grows
+       until it meets the high side; on the high side, allocations
+       can't grow past the space they were given, since that would
+       mean moving them.
+
+       `ak_double_stack_reset_low` and `ak_double_stack_reset` reset
+       the low side and both sides. There is no deinit function, as the
+       allocator holds no resources of its own.
+
+       The double-ended stack is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_DOUBLE_STACK_H_DEFS
+#define ALLOCKIT_DOUBLE_STACK_H_DEFS
+
+#include "allockit.h"
+#include "ak_fixed_buffer.h"
+
+typedef struct AkDoubleStackHigh {
+  AkAlloc alloc;
+  struct AkDoubleStack *stack;
+  unsigned char *last;
+  unsigned char *last_end;
+} AkDoubleStackHigh;
+
+/* The top of the high side is `low.end`, so that the low side stops
+   where the high side starts. */
+typedef struct AkDoubleStack {
+  AkFixedBuffer low;
+  AkDoubleStackHigh high;
+  unsigned char *end;
+} AkDoubleStack;
+
+void ak_double_stack_init(AkDoubleStack *ds, void *buf,
+                          ALLOCKIT_SIZE_T size);
+void ak_double_stack_reset(AkDoubleStack *ds);
+void ak_double_stack_reset_low(AkDoubleStack *ds);
+void ak_double_stack_reset_high(AkDoubleStack *ds);
+
+#endif  /* !ALLOCKIT_DOUBLE_STACK_H_DEFS */
+
+#ifdef ALLOCKIT_DOUBLE_STACK_IMPLEMENTATION
+#ifndef ALLOCKIT_DOUBLE_STACK_H_IMPL
+#define ALLOCKIT_DOUBLE_STACK_H_IMPL
+
+#include <stdint.h>
+
+static
+void *
+akDoubleStackHighAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                       ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkDoubleStackHigh *high = (AkDoubleStackHigh *)alloc;
+  AkFixedBuffer *low = &high->stack->low;
+  uintptr_t ptr;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (size * count > (ALLOCKIT_SIZE_T)(low->end - low->top))
+    return NULL;
+
+  ptr = ((uintptr_t)low->end - size * count) & ~(uintptr_t)(align - 1);
+  if (ptr < (uintptr_t)low->top)
+    return NULL;
+
+  high->last = (unsigned char *)ptr;
+  high->last_end = low->end;
+  low->end = high->last;
+  return high->last;
+}
+
+static
+int
+akDoubleStackHighResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                        ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkDoubleStackHigh *high = (AkDoubleStackHigh *)alloc;
+  unsigned char *ptr = addr;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!ptr || ptr != high->last)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  return size * count <= (ALLOCKIT_SIZE_T)(high->last_end - ptr);
+}
+
+static
+void
+akDoubleStackHighFree(AkAlloc *alloc, void *addr)
+{
+  AkDoubleStackHigh *high = (AkDoubleStackHigh *)alloc;
+
+  if (addr && addr == high->last) {
+    high->stack->low.end = high->last_end;
+    high->last = NULL;
+  }
+}
+
+static
+void
+akDoubleStackHighFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                           ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkDoubleStackHigh *high = (AkDoubleStackHigh *)alloc;
+  AkDoubleStack *ds = high->stack;
+  unsigned char *ptr = addr;
+
+  (void)align;
+
+  if (!ptr || ptr != ds->low.end)
+    return;
+
+  /* The most recent allocation also gets back the padding above it;
+     any other only gets back its own size. */
+  if (ptr == high->last)
+    ds->low.end = high->last_end;
+  else if (size * count <= (ALLOCKIT_SIZE_T)(ds->end - ptr))
+    ds->low.end = ptr + size * count;
+  high->last = NULL;
+}
+
+void
+ak_double_stack_init(AkDoubleStack *ds, void *buf, ALLOCKIT_SIZE_T size)
+{
+  ak_fixed_buffer_init(&ds->low, buf, size);
+
+  ds->high.alloc.alloc = akDoubleStackHighAlloc;
+  ds->high.alloc.resize = akDoubleStackHighResize;
+  ds->high.alloc.free = akDoubleStackHighFree;
+  ds->high.alloc.free_sized = akDoubleStackHighFreeSized;
+  ds->high.alloc.remap = NULL;
+  ds->high.alloc.alloc_ex = NULL;
+  ds->high.alloc.alloc_batch = NULL;
+  ds->high.alloc.free_batch = NULL;
+  ds->high.stack = ds;
+
+  ds->end = ds->low.end;
+  ak_double_stack_reset(ds);
+}
+
+void
+ak_double_stack_reset(AkDoubleStack *ds)
+{
+  ak_double_stack_reset_low(ds);
+  ak_double_stack_reset_high(ds);
+}
+
+void
+ak_double_stack_reset_low(AkDoubleStack *ds)
+{
+  ak_fixed_buffer_reset(&ds->low);
+}
+
+void
+ak_double_stack_reset_high(AkDoubleStack *ds)
+{
+  ds->low.end = ds->end;
+  ds->high.last = NULL;
+  ds->high.last_end = NULL;
+}
+
+#endif  /* !ALLOCKIT_DOUBLE_STACK_H_IMPL */
+#endif  /* ALLOCKIT_DOUBLE_STACK_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,231 @@
+/* ak_fixed_buffer.h - allocator over caller-provided memory for AllocKit
+
+   FLAGS
+     ALLOCKIT_FIXED_BUFFER_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_fixed_buffer.h to emit the implementation.
+
+   USAGE
+
+       A fixed buffer allocator serves allocations out of a single
+       region of memory supplied by the caller, usually a stack array
+       or a static buffer. It never calls into another allocator or
+       the operating system, so once the buffer is resident no
+       allocation made from it can fault or block.
+
+         #include "allockit.h"
+         #include "ak_fixed_buffer.h"
+
+         int
+         parse(const char *input)
+         {
+           unsigned char scratch[4096];
+           AkFixedBuffer fb = {0};
+           ak_fixed_buffer_init(&fb, scratch, sizeof(scratch));
+
+           Token *tokens = ak_alloc(&fb.alloc, Token, 64);
+           if (!tokens)
+             return -1;
+           ...
+
+       When the buffer is exhausted, `alloc` returns NULL.
+
+       `free` releases the most recent allocation, making its space
+       available again; freeing any other allocation is a no-op.
+       `ak_free_sized` releases any allocation that ends at the top of
+       the buffer, so allocations freed in reverse order are all
+       reclaimed.
+       `resize` succeeds only for the most recent allocation, and only
+       while it fits in the remainder of the buffer.
+
+       `ak_fixed_buffer_reset` releases every allocation at once. There
+       is no deinit function, as the allocator holds no resources of
+       its own.
+
+           ak_fixed_buffer_reset(&fb);
+           ...
+         }
+
+       The fixed buffer allocator is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_FIXED_BUFFER_H_DEFS
+#define ALLOCKIT_FIXED_BUFFER_H_DEFS
+
+#include "allockit.h"
+
+typedef struct AkFixedBuffer {
+  AkAlloc alloc;
+  unsigned char *start;
+  unsigned char *top;
+  unsigned char *end;
+  unsigned char *last;
+} AkFixedBuffer;
+
+void ak_fixed_buffer_init(AkFixedBuffer *fb, void *buf,
+                          ALLOCKIT_SIZE_T size);
+void ak_fixed_buffer_reset(AkFixedBuffer *fb);
+
+#endif  /* !ALLOCKIT_FIXED_BUFFER_H_DEFS */
+
+#ifdef ALLOCKIT_FIXED_BUFFER_IMPLEMENTATION
+#ifndef ALLOCKIT_FIXED_BUFFER_H_IMPL
+#define ALLOCKIT_FIXED_BUFFER_H_IMPL
+
+#include <stdint.h>
+
+static
+void *
+akFixedBufferAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkFixedBuffer *fb = (AkFixedBuffer *)alloc;
+  ALLOCKIT_SIZE_T pad;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  pad = (ALLOCKIT_SIZE_T)(-(uintptr_t)fb->top & (align - 1));
+  if (pad > (ALLOCKIT_SIZE_T)(fb->end - fb->top)
+      || size * count > (ALLOCKIT_SIZE_T)(fb->end - fb->top) - pad)
+    return NULL;
+
+  fb->last = fb->top + pad;
+  fb->top = fb->last + size * count;
+  return fb->last;
+}
+
+static
+int
+akFixedBufferResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkFixedBuffer *fb = (AkFixedBuffer *)alloc;
+  unsigned char *ptr = addr;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!ptr || ptr != fb->last)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+  if (size * count > (ALLOCKIT_SIZE_T)(fb->end - ptr))
+    return 0;
+
+  fb->top = ptr + size * count;
+  return 1;
+}
+
+static
+void
+akFixedBufferFree(AkAlloc *alloc, void *addr)
+{
+  AkFixedBuffer *fb = (AkFixedBuffer *)alloc;
+
+  if (addr && addr == fb->last) {
+    fb->top = fb->last;
+    fb->last = NULL;
+  }
+}
+
+static
+void
+akFixedBufferFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                       ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkFixedBuffer *fb = (AkFixedBuffer *)alloc;
+  unsigned char *ptr = addr;
+
+  (void)align;
+
+  if (ptr && ptr >= fb->start && ptr <= fb->top
+      && (ALLOCKIT_SIZE_T)(fb->top - ptr) == size * count) {
+    fb->top = ptr;
+    fb->last = NULL;
+  }
+}
+
+void
+ak_fixed_buffer_init(AkFixedBuffer *fb, void *buf, ALLOCKIT_SIZE_T size)
+{
+  fb->alloc.alloc = akFixedBufferAlloc;
+  fb->alloc.resize = akFixedBufferResize;
+  fb->alloc.free = akFixedBufferFree;
+  fb->alloc.free_sized = akFixedBufferFreeSized;
+  fb->alloc.remap = NULL;
+  fb->alloc.alloc_ex = NULL;
+  fb->alloc.alloc_batch = NULL;
+  fb->alloc.free_batch = NULL;
+  fb->start = buf;
+  fb->top = buf;
+  fb->end = fb->start + size;
+  fb->last = NULL;
+}
+
+void
+ak_fixed_buffer_reset(AkFixedBuffer *fb)
+{
+  fb->top = fb->start;
+  fb->last = NULL;
+}
+
+#endif  /* !ALLOCKIT_FIXED_BUFFER_H_IMPL */
+#endif  /* ALLOCKIT_FIXED_BUFFER_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
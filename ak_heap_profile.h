@@ -0,0 +1,549 @@
+/* ak_heap_profile.h - sampling heap profiler for AllocKit
+
+   FLAGS
+     ALLOCKIT_HEAP_PROFILE_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_heap_profile.h to emit the implementation. The
+       implementation requires POSIX threads and C11 atomics.
+
+     ALLOCKIT_HEAP_PROFILE_RATE (default: 524288)
+       Average number of bytes allocated between two samples, used
+       when `ak_heap_profile_init` is passed a rate of 0.
+
+     ALLOCKIT_HEAP_PROFILE_DEPTH (default: 32)
+       Maximum number of stack frames recorded per sample.
+
+     ALLOCKIT_HEAP_PROFILE_BUCKETS (default: 4096)
+       Number of buckets in the table of live samples. Must be a power
+       of two.
+
+     ALLOCKIT_HEAP_PROFILE_BACKTRACE(frames, depth)
+       Stores up to `depth` return addresses of the current stack into
+       the `void *` array `frames`, and evaluates to the number
+       stored. Defaults to `backtrace` from <execinfo.h> where that is
+       available, and to recording no frames otherwise.
+
+   USAGE
+
+       The heap profiler forwards every call to an inner allocator,
+       and records a stack trace for a random sample of allocations,
+       about one per ALLOCKIT_HEAP_PROFILE_RATE bytes allocated. The
+       samples that are still live can be written out at any time as
+       a heap profile for pprof, which scales them back up to
+       estimate the whole heap.
+
+         #include "allockit.h"
+         #include "ak_heap_profile.h"
+
+         AkHeapProfile prof = {0};
+         if (!ak_heap_profile_init(&prof, backing, 0))
+           return -1;
+
+         run_server(&prof.alloc);
+
+         FILE *out = fopen("heap.prof", "w");
+         ak_heap_profile_write(&prof, out);
+         fclose(out);
+
+         $ go tool pprof -inuse_space ./server heap.prof
+
+       Sampling is a Poisson process over bytes, the same as in
+       tcmalloc: the number of bytes until the next sample is drawn
+       from an exponential distribution, so an allocation of `n` bytes
+       is sampled with probability 1 - exp(-n / rate), however the
+       allocations before it were sized. The countdown is kept per
+       thread and shared by all profilers, so an allocation that is
+       not sampled costs a thread-local subtraction, and a `free` of
+       it costs one load from the table of samples, plus the calls to
+       the inner allocator.
+
+       A sampled allocation costs a stack trace and an insertion into
+       the table of samples under a lock, and its record is allocated
+       from the inner allocator. A `free` that lands in a bucket of
+       the table holding a sample takes the lock to search it.
+
+       `ak_heap_profile_write` writes the samples in the legacy text
+       format of gperftools heap profiles (`heap_v2`), one sample per
+       line, followed by /proc/self/maps if it can be read, so that
+       pprof can symbolize the addresses. Only live samples are kept,
+       so the profile's allocated space equals its in-use space. The
+       topmost frames of each stack are the profiler's own. It
+       returns 0 if writing fails.
+
+       The profiler is as thread-safe as the inner allocator, which
+       must be thread-safe if the profiler is used from several
+       threads. `ak_heap_profile_deinit` frees the records of the
+       samples, but not the sampled allocations.
+
+         ak_heap_profile_deinit(&prof);
+
+ */
+
+#ifndef ALLOCKIT_HEAP_PROFILE_H_DEFS
+#define ALLOCKIT_HEAP_PROFILE_H_DEFS
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_HEAP_PROFILE_RATE
+#  define ALLOCKIT_HEAP_PROFILE_RATE 524288
+#endif  /* !ALLOCKIT_HEAP_PROFILE_RATE */
+
+#ifndef ALLOCKIT_HEAP_PROFILE_DEPTH
+#  define ALLOCKIT_HEAP_PROFILE_DEPTH 32
+#endif  /* !ALLOCKIT_HEAP_PROFILE_DEPTH */
+
+#ifndef ALLOCKIT_HEAP_PROFILE_BUCKETS
+#  define ALLOCKIT_HEAP_PROFILE_BUCKETS 4096
+#endif  /* !ALLOCKIT_HEAP_PROFILE_BUCKETS */
+
+typedef struct AkHeapProfileSample {
+  struct AkHeapProfileSample *next;
+  void *addr;
+  ALLOCKIT_SIZE_T bytes;
+  int depth;
+  void *frames[ALLOCKIT_HEAP_PROFILE_DEPTH];
+} AkHeapProfileSample;
+
+typedef struct AkHeapProfileBucket {
+  _Atomic unsigned count;
+  AkHeapProfileSample *samples;
+} AkHeapProfileBucket;
+
+typedef struct AkHeapProfile {
+  AkAlloc alloc;
+  AkAlloc *inner;
+  ALLOCKIT_SIZE_T rate;
+  pthread_mutex_t lock;
+  AkHeapProfileBucket *buckets;
+} AkHeapProfile;
+
+int ak_heap_profile_init(AkHeapProfile *prof, AkAlloc *inner,
+                         ALLOCKIT_SIZE_T rate);
+void ak_heap_profile_deinit(AkHeapProfile *prof);
+
+int ak_heap_profile_write(AkHeapProfile *prof, FILE *out);
+
+#endif  /* !ALLOCKIT_HEAP_PROFILE_H_DEFS */
+
+#ifdef ALLOCKIT_HEAP_PROFILE_IMPLEMENTATION
+#ifndef ALLOCKIT_HEAP_PROFILE_H_IMPL
+#define ALLOCKIT_HEAP_PROFILE_H_IMPL
+
+#ifndef ALLOCKIT_HEAP_PROFILE_BACKTRACE
+#  if defined(__has_include)
+#    if __has_include(<execinfo.h>)
+#      include <execinfo.h>
+#      define ALLOCKIT_HEAP_PROFILE_BACKTRACE(frames, depth) \
+         backtrace((frames), (depth))
+#    endif  /* __has_include(<execinfo.h>) */
+#  endif  /* __has_include */
+#endif  /* !ALLOCKIT_HEAP_PROFILE_BACKTRACE */
+
+#ifndef ALLOCKIT_HEAP_PROFILE_BACKTRACE
+#  define ALLOCKIT_HEAP_PROFILE_BACKTRACE(frames, depth) \
+     ((void)(frames), (void)(depth), 0)
+#endif  /* !ALLOCKIT_HEAP_PROFILE_BACKTRACE */
+
+typedef struct AkHeapProfileThread {
+  int64_t until;
+  uint64_t rng;
+} AkHeapProfileThread;
+
+static _Thread_local AkHeapProfileThread akHeapProfileThread;
+
+/* xorshift64*, seeded per thread. */
+static
+uint64_t
+akHeapProfileRandom(AkHeapProfileThread *thread)
+{
+  uint64_t x = thread->rng;
+
+  x ^= x >> 12;
+  x ^= x << 25;
+  x ^= x >> 27;
+  thread->rng = x;
+  return x * 0x2545f4914f6cdd1dull;
+}
+
+/* Returns -ln(u) for u uniform in (0, 1], without libm. u is scaled
+   into [0.5, 1) by powers of two, and the log of the rest is taken
+   from the series ln(x) = 2 * atanh((x - 1) / (x + 1)), which for x
+   in [0.5, 1) is within 2e-7 after six terms. */
+static
+double
+akHeapProfileExponential(AkHeapProfileThread *thread)
+{
+  double x = (double)((akHeapProfileRandom(thread) >> 11) + 1)
+             / 9007199254740992.0;
+  double y, y2, ln;
+  int e = 0;
+
+  while (x < 0.5) {
+    x *= 2;
+    e++;
+  }
+
+  y = (x - 1) / (x + 1);
+  y2 = y * y;
+  ln = 2 * y * (1 + y2 * (1.0 / 3 + y2 * (1.0 / 5 + y2 * (1.0 / 7
+                                                  + y2 * (1.0 / 9
+                                                  + y2 * (1.0 / 11))))));
+  return e * 0.6931471805599453 - ln;
+}
+
+static
+int64_t
+akHeapProfileInterval(AkHeapProfile *prof, AkHeapProfileThread *thread)
+{
+  return (int64_t)(akHeapProfileExponential(thread) * prof->rate) + 1;
+}
+
+/* Counts bytes down towards the next sample, and returns whether this
+   allocation is it. */
+static
+int
+akHeapProfileShouldSample(AkHeapProfile *prof, ALLOCKIT_SIZE_T bytes)
+{
+  AkHeapProfileThread *thread = &akHeapProfileThread;
+
+  if ((thread->until -= (int64_t)bytes) > 0)
+    return 0;
+
+  if (!thread->rng) {
+    /* First allocation on this thread: start a countdown instead of
+       sampling it. */
+    thread->rng = ((uint64_t)(uintptr_t)thread * 0x9e3779b97f4a7c15ull)
+                  | 1;
+    thread->until = akHeapProfileInterval(prof, thread) - (int64_t)bytes;
+    if (thread->until > 0)
+      return 0;
+  }
+
+  thread->until = akHeapProfileInterval(prof, thread);
+  return 1;
+}
+
+static
+AkHeapProfileBucket *
+akHeapProfileBucketOf(AkHeapProfile *prof, void *addr)
+{
+  uint64_t hash = (uint64_t)(uintptr_t)addr * 0x9e3779b97f4a7c15ull;
+
+  return &prof->buckets[(hash >> 32) & (ALLOCKIT_HEAP_PROFILE_BUCKETS - 1)];
+}
+
+static
+void
+akHeapProfileRecord(AkHeapProfile *prof, void *addr, ALLOCKIT_SIZE_T bytes)
+{
+  AkHeapProfileBucket *bucket = akHeapProfileBucketOf(prof, addr);
+  AkHeapProfileSample *sample = ak_alloc(prof->inner, AkHeapProfileSample,
+                                         1);
+
+  if (!sample)
+    return;
+
+  sample->addr = addr;
+  sample->bytes = bytes;
+  sample->depth =
+    ALLOCKIT_HEAP_PROFILE_BACKTRACE(sample->frames,
+                                    ALLOCKIT_HEAP_PROFILE_DEPTH);
+
+  pthread_mutex_lock(&prof->lock);
+  sample->next = bucket->samples;
+  bucket->samples = sample;
+  atomic_fetch_add_explicit(&bucket->count, 1, memory_order_relaxed);
+  pthread_mutex_unlock(&prof->lock);
+}
+
+/* Returns the link pointing to the sample for addr, or NULL. Must be
+   called with the lock held. */
+static
+AkHeapProfileSample **
+akHeapProfileFind(AkHeapProfileBucket *bucket, void *addr)
+{
+  AkHeapProfileSample **link;
+
+  for (link = &bucket->samples; *link; link = &(*link)->next)
+    if ((*link)->addr == addr)
+      return link;
+  return NULL;
+}
+
+static
+void
+akHeapProfileForget(AkHeapProfile *prof, void *addr)
+{
+  AkHeapProfileBucket *bucket = akHeapProfileBucketOf(prof, addr);
+  AkHeapProfileSample *sample = NULL;
+  AkHeapProfileSample **link;
+
+  /* An allocation can only be in the table if it was sampled by the
+     thread that made it, before that thread handed it out, so a
+     relaxed load can't miss it. */
+  if (!atomic_load_explicit(&bucket->count, memory_order_relaxed))
+    return;
+
+  pthread_mutex_lock(&prof->lock);
+  link = akHeapProfileFind(bucket, addr);
+  if (link) {
+    sample = *link;
+    *link = sample->next;
+    atomic_fetch_sub_explicit(&bucket->count, 1, memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&prof->lock);
+
+  if (sample)
+    ak_free_sized(prof->inner, sample, AkHeapProfileSample, 1);
+}
+
+static
+void *
+akHeapProfileAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                     ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                     ALLOCKIT_SIZE_T *usable)
+{
+  AkHeapProfile *prof = (AkHeapProfile *)alloc;
+  void *addr;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  addr = ak_alloc_ex_raw(prof->inner, size, align, count, usable);
+  if (addr && akHeapProfileShouldSample(prof, size * count))
+    akHeapProfileRecord(prof, addr, size * count);
+  return addr;
+}
+
+static
+void *
+akHeapProfileAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akHeapProfileAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akHeapProfileResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkHeapProfile *prof = (AkHeapProfile *)alloc;
+  AkHeapProfileBucket *bucket;
+  AkHeapProfileSample **link;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!ak_resize_raw(prof->inner, addr, size, align, count))
+    return 0;
+
+  bucket = akHeapProfileBucketOf(prof, addr);
+  if (atomic_load_explicit(&bucket->count, memory_order_relaxed)) {
+    pthread_mutex_lock(&prof->lock);
+    link = akHeapProfileFind(bucket, addr);
+    if (link)
+      (*link)->bytes = size * count;
+    pthread_mutex_unlock(&prof->lock);
+  }
+
+  return 1;
+}
+
+static
+void
+akHeapProfileFree(AkAlloc *alloc, void *addr)
+{
+  AkHeapProfile *prof = (AkHeapProfile *)alloc;
+
+  if (!addr)
+    return;
+
+  akHeapProfileForget(prof, addr);
+  ak_free(prof->inner, addr);
+}
+
+static
+void
+akHeapProfileFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                       ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkHeapProfile *prof = (AkHeapProfile *)alloc;
+
+  if (!addr)
+    return;
+
+  akHeapProfileForget(prof, addr);
+  ak_free_sized_raw(prof->inner, addr, size, align, count);
+}
+
+int
+ak_heap_profile_init(AkHeapProfile *prof, AkAlloc *inner,
+                     ALLOCKIT_SIZE_T rate)
+{
+  unsigned i;
+
+  prof->alloc.alloc = akHeapProfileAlloc;
+  prof->alloc.resize = akHeapProfileResize;
+  prof->alloc.free = akHeapProfileFree;
+  prof->alloc.free_sized = akHeapProfileFreeSized;
+  prof->alloc.remap = NULL;
+  prof->alloc.alloc_ex = akHeapProfileAllocEx;
+  prof->alloc.alloc_batch = NULL;
+  prof->alloc.free_batch = NULL;
+  prof->inner = inner;
+  prof->rate = rate ? rate : ALLOCKIT_HEAP_PROFILE_RATE;
+
+  prof->buckets = ak_alloc(inner, AkHeapProfileBucket,
+                           ALLOCKIT_HEAP_PROFILE_BUCKETS);
+  if (!prof->buckets)
+    return 0;
+
+  for (i = 0; i < ALLOCKIT_HEAP_PROFILE_BUCKETS; i++) {
+    atomic_init(&prof->buckets[i].count, 0);
+    prof->buckets[i].samples = NULL;
+  }
+
+  if (pthread_mutex_init(&prof->lock, NULL) != 0) {
+    ak_free_sized(inner, prof->buckets, AkHeapProfileBucket,
+                  ALLOCKIT_HEAP_PROFILE_BUCKETS);
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+ak_heap_profile_deinit(AkHeapProfile *prof)
+{
+  unsigned i;
+
+  for (i = 0; i < ALLOCKIT_HEAP_PROFILE_BUCKETS; i++) {
+    AkHeapProfileSample *sample = prof->buckets[i].samples;
+
+    while (sample) {
+      AkHeapProfileSample *next = sample->next;
+      ak_free_sized(prof->inner, sample, AkHeapProfileSample, 1);
+      sample = next;
+    }
+  }
+
+  ak_free_sized(prof->inner, prof->buckets, AkHeapProfileBucket,
+                ALLOCKIT_HEAP_PROFILE_BUCKETS);
+  prof->buckets = NULL;
+  pthread_mutex_destroy(&prof->lock);
+}
+
+int
+ak_heap_profile_write(AkHeapProfile *prof, FILE *out)
+{
+  unsigned long long objects = 0, bytes = 0;
+  FILE *maps;
+  unsigned i;
+  int d;
+
+  pthread_mutex_lock(&prof->lock);
+
+  for (i = 0; i < ALLOCKIT_HEAP_PROFILE_BUCKETS; i++) {
+    AkHeapProfileSample *sample;
+
+    for (sample = prof->buckets[i].samples; sample; sample = sample->next) {
+      objects++;
+      bytes += sample->bytes;
+    }
+  }
+
+  fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n",
+          objects, bytes, objects, bytes, (unsigned long long)prof->rate);
+
+  for (i = 0; i < ALLOCKIT_HEAP_PROFILE_BUCKETS; i++) {
+    AkHeapProfileSample *sample;
+
+    for (sample = prof->buckets[i].samples; sample; sample = sample->next) {
+      fprintf(out, "1: %llu [1: %llu] @",
+              (unsigned long long)sample->bytes,
+              (unsigned long long)sample->bytes);
+      for (d = 0; d < sample->depth; d++)
+        fprintf(out, " %p", sample->frames[d]);
+      fputc('\n', out);
+    }
+  }
+
+  pthread_mutex_unlock(&prof->lock);
+
+  maps = fopen("/proc/self/maps", "r");
+  if (maps) {
+    char buf[4096];
+    size_t n;
+
+    fputs("\nMAPPED_LIBRARIES:\n", out);
+    while ((n = fread(buf, 1, sizeof(buf), maps)) > 0)
+      fwrite(buf, 1, n, out);
+    fclose(maps);
+  }
+
+  return !ferror(out);
+}
+
+#endif  /* !ALLOCKIT_HEAP_PROFILE_H_IMPL */
+#endif  /* ALLOCKIT_HEAP_PROFILE_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
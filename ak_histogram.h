@@ -0,0 +1,531 @@
+/* ak_histogram.h - size and lifetime histograms for AllocKit
+
+   FLAGS
+     ALLOCKIT_HISTOGRAM_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_histogram.h to emit the implementation. The implementation
+       requires C11 atomics.
+
+     ALLOCKIT_HISTOGRAM_ALIGNS (default: 16)
+       Number of alignment buckets. Bucket i counts allocations aligned
+       to 2^i bytes, and the last bucket also counts larger alignments.
+
+     ALLOCKIT_HISTOGRAM_LIFETIMES (default: 32)
+       Number of lifetime buckets. Bucket i counts allocations that
+       lived for at least 2^i - 1 and less than 2^(i+1) - 1 ticks, and
+       the last bucket also counts longer lifetimes.
+
+     ALLOCKIT_HISTOGRAM_TIME
+       Define this to measure lifetimes in nanoseconds of
+       CLOCK_MONOTONIC, instead of in allocator calls. Requires POSIX.
+
+   USAGE
+
+       The histogram wrapper forwards every call to an inner
+       allocator, and sorts each allocation into a bucket by its size
+       in bytes (`size * count`). Per bucket, it counts allocations by
+       alignment, and how long they lived before being freed. The
+       result shows what a program really allocates, which is what a
+       slab allocator's size classes, or the choice of what goes into
+       an arena, should be based on.
+
+         #include "allockit.h"
+         #include "ak_histogram.h"
+
+         AkHistogram hist = {0};
+         if (!ak_histogram_init(&hist, backing))
+           return -1;
+
+         run_subsystem(&hist.alloc);
+
+         for (unsigned i = 0; i < ALLOCKIT_HISTOGRAM_SIZES; i++) {
+           AkHistogramBucket bucket;
+           ak_histogram_read(&hist, i, &bucket);
+           if (bucket.allocs)
+             printf("<= %zu: %llu allocs, %llu ticks on average\n",
+                    ak_histogram_class_size(i),
+                    (unsigned long long)bucket.allocs,
+                    (unsigned long long)(bucket.frees
+                                         ? bucket.lifetime_total
+                                           / bucket.frees
+                                         : 0));
+         }
+
+       Sizes of up to 8 bytes each have their own bucket. Above that,
+       every power of two is split into four buckets of equal width,
+       so a bucket's largest size is at most 25% above its smallest.
+       `ak_histogram_class_size` returns the largest size in a bucket.
+
+       `ak_histogram_read` fills in, for one bucket:
+
+         allocs, frees, resizes
+           Number of successful calls that ended up in the bucket. A
+           successful `resize` is counted in the bucket of the old
+           size, and moves the allocation to the bucket of the new
+           size.
+         live
+           Number of allocations currently in the bucket.
+         aligns[i]
+           Number of allocations in the bucket aligned to 2^i bytes.
+         lifetimes[i], lifetime_total
+           Lifetimes of the allocations freed from the bucket, binned
+           by powers of two and summed.
+
+       By default, time is counted in ticks of a clock that advances
+       once on every `alloc` and `free` through the wrapper, so a
+       lifetime says how many other allocations and frees happened in
+       between. That is usually what matters for deciding whether an
+       allocation can live in an arena or a ring, and, unlike wall
+       time, doesn't vary between runs. Define ALLOCKIT_HISTOGRAM_TIME
+       to measure in nanoseconds instead.
+
+       To find the size and age of an allocation on `free`, each
+       allocation carries a small header in front of the returned
+       address, rounded up to the allocation's alignment.
+
+       Buckets are updated with relaxed atomic adds, so the wrapper is
+       as thread-safe as the inner allocator, at the cost of threads
+       contending on the counters. A bucket read while other threads
+       are allocating may be inconsistent by a few calls.
+
+       The buckets are allocated from the inner allocator by
+       `ak_histogram_init`, and returned to it by
+       `ak_histogram_deinit`.
+
+         ak_histogram_deinit(&hist);
+
+ */
+
+#ifndef ALLOCKIT_HISTOGRAM_H_DEFS
+#define ALLOCKIT_HISTOGRAM_H_DEFS
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_HISTOGRAM_ALIGNS
+#  define ALLOCKIT_HISTOGRAM_ALIGNS 16
+#endif  /* !ALLOCKIT_HISTOGRAM_ALIGNS */
+
+#ifndef ALLOCKIT_HISTOGRAM_LIFETIMES
+#  define ALLOCKIT_HISTOGRAM_LIFETIMES 32
+#endif  /* !ALLOCKIT_HISTOGRAM_LIFETIMES */
+
+/* Sizes 0 to 8, then four buckets per power of two up to 2^64. */
+#define ALLOCKIT_HISTOGRAM_SIZES (9 + 61 * 4)
+
+typedef struct AkHistogramBucket {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t resizes;
+  uint64_t live;
+  uint64_t lifetime_total;
+  uint64_t aligns[ALLOCKIT_HISTOGRAM_ALIGNS];
+  uint64_t lifetimes[ALLOCKIT_HISTOGRAM_LIFETIMES];
+} AkHistogramBucket;
+
+typedef struct AkHistogramCounters {
+  _Atomic uint64_t allocs;
+  _Atomic uint64_t frees;
+  _Atomic uint64_t resizes;
+  _Atomic uint64_t live;
+  _Atomic uint64_t lifetime_total;
+  _Atomic uint64_t aligns[ALLOCKIT_HISTOGRAM_ALIGNS];
+  _Atomic uint64_t lifetimes[ALLOCKIT_HISTOGRAM_LIFETIMES];
+} AkHistogramCounters;
+
+typedef struct AkHistogram {
+  AkAlloc alloc;
+  AkAlloc *inner;
+  AkHistogramCounters *buckets;
+  _Atomic uint64_t clock;
+} AkHistogram;
+
+int ak_histogram_init(AkHistogram *hist, AkAlloc *inner);
+void ak_histogram_deinit(AkHistogram *hist);
+
+void ak_histogram_read(AkHistogram *hist, unsigned cls,
+                       AkHistogramBucket *bucket);
+ALLOCKIT_SIZE_T ak_histogram_class_size(unsigned cls);
+
+#endif  /* !ALLOCKIT_HISTOGRAM_H_DEFS */
+
+#ifdef ALLOCKIT_HISTOGRAM_IMPLEMENTATION
+#ifndef ALLOCKIT_HISTOGRAM_H_IMPL
+#define ALLOCKIT_HISTOGRAM_H_IMPL
+
+#ifdef ALLOCKIT_HISTOGRAM_TIME
+#  include <time.h>
+#endif  /* ALLOCKIT_HISTOGRAM_TIME */
+
+typedef struct AkHistogramHeader {
+  unsigned char *base;
+  ALLOCKIT_SIZE_T bytes;
+  uint64_t born;
+} AkHistogramHeader;
+
+static
+AkHistogramHeader *
+akHistogramHeaderOf(void *addr)
+{
+  return (AkHistogramHeader *)addr - 1;
+}
+
+static
+ALLOCKIT_SIZE_T
+akHistogramAlign(ALLOCKIT_SIZE_T align)
+{
+  if (align < ALLOCKIT_ALIGNOF(AkHistogramHeader))
+    return ALLOCKIT_ALIGNOF(AkHistogramHeader);
+  return align;
+}
+
+static
+ALLOCKIT_SIZE_T
+akHistogramOffset(ALLOCKIT_SIZE_T align)
+{
+  return (sizeof(AkHistogramHeader) + align - 1) & ~(align - 1);
+}
+
+static
+unsigned
+akHistogramLog2(uint64_t n)
+{
+  unsigned log = 0;
+
+  while (n >>= 1)
+    log++;
+  return log;
+}
+
+static
+unsigned
+akHistogramSizeClass(uint64_t bytes)
+{
+  unsigned log;
+
+  if (bytes <= 8)
+    return (unsigned)bytes;
+
+  /* The top bit of bytes - 1 picks the power of two, and the two bits
+     below it pick the quarter. */
+  log = akHistogramLog2(bytes - 1);
+  return 9 + (log - 3) * 4 + (unsigned)((bytes - 1) >> (log - 2)) - 4;
+}
+
+static
+uint64_t
+akHistogramNow(AkHistogram *hist)
+{
+#ifdef ALLOCKIT_HISTOGRAM_TIME
+  struct timespec ts;
+
+  (void)hist;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#else
+  return atomic_fetch_add_explicit(&hist->clock, 1, memory_order_relaxed);
+#endif  /* ALLOCKIT_HISTOGRAM_TIME */
+}
+
+static
+void
+akHistogramAdd(_Atomic uint64_t *counter, uint64_t n)
+{
+  atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+}
+
+static
+void
+akHistogramRecordFree(AkHistogram *hist, AkHistogramHeader *header)
+{
+  AkHistogramCounters *bucket =
+    &hist->buckets[akHistogramSizeClass(header->bytes)];
+  uint64_t lifetime = akHistogramNow(hist) - header->born;
+  unsigned bin = akHistogramLog2(lifetime + 1);
+
+  if (bin >= ALLOCKIT_HISTOGRAM_LIFETIMES)
+    bin = ALLOCKIT_HISTOGRAM_LIFETIMES - 1;
+
+  akHistogramAdd(&bucket->frees, 1);
+  akHistogramAdd(&bucket->live, (uint64_t)-1);
+  akHistogramAdd(&bucket->lifetime_total, lifetime);
+  akHistogramAdd(&bucket->lifetimes[bin], 1);
+}
+
+static
+void *
+akHistogramAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                   ALLOCKIT_SIZE_T *usable)
+{
+  AkHistogram *hist = (AkHistogram *)alloc;
+  AkHistogramCounters *bucket;
+  AkHistogramHeader *header;
+  ALLOCKIT_SIZE_T offset, got;
+  unsigned char *base;
+  unsigned bin;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  bin = akHistogramLog2(align);
+  if (bin >= ALLOCKIT_HISTOGRAM_ALIGNS)
+    bin = ALLOCKIT_HISTOGRAM_ALIGNS - 1;
+
+  align = akHistogramAlign(align);
+  offset = akHistogramOffset(align);
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - offset)
+    return NULL;
+
+  base = ak_alloc_ex_raw(hist->inner, offset + size * count, align, 1,
+                         &got);
+  if (!base)
+    return NULL;
+
+  header = akHistogramHeaderOf(base + offset);
+  header->base = base;
+  header->bytes = size * count;
+  header->born = akHistogramNow(hist);
+
+  bucket = &hist->buckets[akHistogramSizeClass(header->bytes)];
+  akHistogramAdd(&bucket->allocs, 1);
+  akHistogramAdd(&bucket->live, 1);
+  akHistogramAdd(&bucket->aligns[bin], 1);
+
+  *usable = got - offset;
+  return base + offset;
+}
+
+static
+void *
+akHistogramAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                 ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akHistogramAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akHistogramResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                  ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkHistogram *hist = (AkHistogram *)alloc;
+  AkHistogramCounters *from, *to;
+  AkHistogramHeader *header;
+  ALLOCKIT_SIZE_T offset;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  align = akHistogramAlign(align);
+  offset = akHistogramOffset(align);
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - offset)
+    return 0;
+
+  header = akHistogramHeaderOf(addr);
+  if (!ak_resize_raw(hist->inner, header->base, offset + size * count,
+                     align, 1))
+    return 0;
+
+  from = &hist->buckets[akHistogramSizeClass(header->bytes)];
+  to = &hist->buckets[akHistogramSizeClass(size * count)];
+  akHistogramAdd(&from->resizes, 1);
+  akHistogramAdd(&from->live, (uint64_t)-1);
+  akHistogramAdd(&to->live, 1);
+  header->bytes = size * count;
+  return 1;
+}
+
+static
+void
+akHistogramFree(AkAlloc *alloc, void *addr)
+{
+  AkHistogram *hist = (AkHistogram *)alloc;
+  AkHistogramHeader *header;
+
+  if (!addr)
+    return;
+
+  header = akHistogramHeaderOf(addr);
+  akHistogramRecordFree(hist, header);
+  ak_free(hist->inner, header->base);
+}
+
+static
+void
+akHistogramFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                     ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkHistogram *hist = (AkHistogram *)alloc;
+  AkHistogramHeader *header;
+  ALLOCKIT_SIZE_T offset;
+
+  if (!addr)
+    return;
+
+  header = akHistogramHeaderOf(addr);
+  akHistogramRecordFree(hist, header);
+
+  align = akHistogramAlign(align);
+  offset = akHistogramOffset(align);
+  ak_free_sized_raw(hist->inner, header->base, offset + size * count,
+                    align, 1);
+}
+
+int
+ak_histogram_init(AkHistogram *hist, AkAlloc *inner)
+{
+  unsigned i, j;
+
+  hist->alloc.alloc = akHistogramAlloc;
+  hist->alloc.resize = akHistogramResize;
+  hist->alloc.free = akHistogramFree;
+  hist->alloc.free_sized = akHistogramFreeSized;
+  hist->alloc.remap = NULL;
+  hist->alloc.alloc_ex = akHistogramAllocEx;
+  hist->alloc.alloc_batch = NULL;
+  hist->alloc.free_batch = NULL;
+  hist->inner = inner;
+  atomic_init(&hist->clock, 0);
+
+  hist->buckets = ak_alloc(inner, AkHistogramCounters,
+                           ALLOCKIT_HISTOGRAM_SIZES);
+  if (!hist->buckets)
+    return 0;
+
+  for (i = 0; i < ALLOCKIT_HISTOGRAM_SIZES; i++) {
+    AkHistogramCounters *bucket = &hist->buckets[i];
+
+    atomic_init(&bucket->allocs, 0);
+    atomic_init(&bucket->frees, 0);
+    atomic_init(&bucket->resizes, 0);
+    atomic_init(&bucket->live, 0);
+    atomic_init(&bucket->lifetime_total, 0);
+    for (j = 0; j < ALLOCKIT_HISTOGRAM_ALIGNS; j++)
+      atomic_init(&bucket->aligns[j], 0);
+    for (j = 0; j < ALLOCKIT_HISTOGRAM_LIFETIMES; j++)
+      atomic_init(&bucket->lifetimes[j], 0);
+  }
+
+  return 1;
+}
+
+void
+ak_histogram_deinit(AkHistogram *hist)
+{
+  ak_free_sized(hist->inner, hist->buckets, AkHistogramCounters,
+                ALLOCKIT_HISTOGRAM_SIZES);
+  hist->buckets = NULL;
+}
+
+void
+ak_histogram_read(AkHistogram *hist, unsigned cls,
+                  AkHistogramBucket *bucket)
+{
+  AkHistogramCounters *counters = &hist->buckets[cls];
+  unsigned i;
+
+  ALLOCKIT_ASSERT(cls < ALLOCKIT_HISTOGRAM_SIZES);
+
+  bucket->allocs = atomic_load_explicit(&counters->allocs,
+                                        memory_order_relaxed);
+  bucket->frees = atomic_load_explicit(&counters->frees,
+                                       memory_order_relaxed);
+  bucket->resizes = atomic_load_explicit(&counters->resizes,
+                                         memory_order_relaxed);
+  bucket->live = atomic_load_explicit(&counters->live,
+                                      memory_order_relaxed);
+  bucket->lifetime_total = atomic_load_explicit(&counters->lifetime_total,
+                                                memory_order_relaxed);
+  for (i = 0; i < ALLOCKIT_HISTOGRAM_ALIGNS; i++)
+    bucket->aligns[i] = atomic_load_explicit(&counters->aligns[i],
+                                             memory_order_relaxed);
+  for (i = 0; i < ALLOCKIT_HISTOGRAM_LIFETIMES; i++)
+    bucket->lifetimes[i] = atomic_load_explicit(&counters->lifetimes[i],
+                                                memory_order_relaxed);
+}
+
+ALLOCKIT_SIZE_T
+ak_histogram_class_size(unsigned cls)
+{
+  unsigned log, bits;
+
+  ALLOCKIT_ASSERT(cls < ALLOCKIT_HISTOGRAM_SIZES);
+
+  if (cls <= 8)
+    return cls;
+
+  /* Buckets past what ALLOCKIT_SIZE_T can hold end at its maximum. */
+  log = 3 + (cls - 9) / 4;
+  bits = sizeof(ALLOCKIT_SIZE_T) * 8;
+  if (log >= bits || (log == bits - 1 && (cls - 9) % 4 == 3))
+    return (ALLOCKIT_SIZE_T)-1;
+  return (ALLOCKIT_SIZE_T)(5 + (cls - 9) % 4) << (log - 2);
+}
+
+#endif  /* !ALLOCKIT_HISTOGRAM_H_IMPL */
+#endif  /* ALLOCKIT_HISTOGRAM_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,467 @@
+/* ak_locked.h - locking adapter for AllocKit
+
+   FLAGS
+     ALLOCKIT_LOCKED_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_locked.h to emit the implementation. The implementation
+       requires C11 atomics, and Linux for ALLOCKIT_LOCKED_FUTEX,
+       which calls `syscall` and so must be compiled with
+       _DEFAULT_SOURCE or _GNU_SOURCE defined under a strict
+       -std=c11.
+
+     ALLOCKIT_LOCKED_LOCK (default: ALLOCKIT_LOCKED_FUTEX on Linux,
+                           ALLOCKIT_LOCKED_SPIN otherwise)
+       Lock used by every `AkLocked`, one of:
+
+       ALLOCKIT_LOCKED_SPIN
+         Test-and-test-and-set spinlock with exponential backoff, which
+         yields the CPU once it has spun for a while. Cheapest when
+         critical sections are short and threads rarely collide.
+
+       ALLOCKIT_LOCKED_TICKET
+         Ticket lock, which hands the lock to waiters in the order they
+         arrived. Fair under heavy contention, but every waiter
+         collapses to the speed of the slowest when one is descheduled.
+
+       ALLOCKIT_LOCKED_FUTEX
+         Mutex built directly on the Linux futex system call, which
+         spins briefly and then sleeps in the kernel. Costs a single
+         atomic operation each way when uncontended, and doesn't burn
+         CPU when it is.
+
+       The flag must have the same value everywhere ak_locked.h is
+       included, since it changes the layout of `AkLocked`.
+
+     ALLOCKIT_LOCKED_SPINS (default: 100)
+       Number of times a lock is retried before it yields or sleeps.
+
+   USAGE
+
+       The locked adapter makes any allocator thread-safe by taking a
+       single lock around every call to it.
+
+         #include "allockit.h"
+         #include "ak_slab.h"
+         #include "ak_locked.h"
+
+         AkSlab slab = {0};
+         AkLocked locked = {0};
+
+         ak_slab_init(&slab, &ak_page_allocator);
+         ak_locked_init(&locked, &slab.alloc);
+
+         do_work_on_many_threads(&locked.alloc);
+
+       Every member of `AkAlloc` is wrapped, including the optional
+       ones, which behave exactly as they do for the inner allocator.
+
+       A single lock serializes every thread, so when many threads
+       allocate at once, `AkSharded` from ak_sharded.h, or a caching
+       front-end, will scale better. The locked adapter is the simplest
+       way to share an allocator that is used from several threads but
+       rarely from more than one at a time, such as the backing
+       allocator of those front-ends.
+
+       `ak_locked_deinit` does nothing for any of the locks, but should
+       still be called in case that changes. The inner allocator is
+       not touched.
+
+         ak_locked_deinit(&locked);
+         ak_slab_deinit(&slab);
+
+ */
+
+#ifndef ALLOCKIT_LOCKED_H_DEFS
+#define ALLOCKIT_LOCKED_H_DEFS
+
+#include <stdatomic.h>
+
+#include "allockit.h"
+
+#define ALLOCKIT_LOCKED_SPIN 1
+#define ALLOCKIT_LOCKED_TICKET 2
+#define ALLOCKIT_LOCKED_FUTEX 3
+
+#ifndef ALLOCKIT_LOCKED_LOCK
+#  ifdef __linux__
+#    define ALLOCKIT_LOCKED_LOCK ALLOCKIT_LOCKED_FUTEX
+#  else
+#    define ALLOCKIT_LOCKED_LOCK ALLOCKIT_LOCKED_SPIN
+#  endif  /* __linux__ */
+#endif  /* !ALLOCKIT_LOCKED_LOCK */
+
+#ifndef ALLOCKIT_LOCKED_SPINS
+#  define ALLOCKIT_LOCKED_SPINS 100
+#endif  /* !ALLOCKIT_LOCKED_SPINS */
+
+#if ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_TICKET
+typedef struct AkLockedLock {
+  atomic_uint next;
+  atomic_uint serving;
+} AkLockedLock;
+#elif ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_SPIN \
+  || ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_FUTEX
+typedef struct AkLockedLock {
+  atomic_int state;
+} AkLockedLock;
+#else
+#  error "ALLOCKIT_LOCKED_LOCK must be SPIN, TICKET or FUTEX"
+#endif  /* ALLOCKIT_LOCKED_LOCK */
+
+typedef struct AkLocked {
+  AkAlloc alloc;
+  AkAlloc *inner;
+  AkLockedLock lock;
+} AkLocked;
+
+void ak_locked_init(AkLocked *locked, AkAlloc *inner);
+void ak_locked_deinit(AkLocked *locked);
+
+#endif  /* !ALLOCKIT_LOCKED_H_DEFS */
+
+#ifdef ALLOCKIT_LOCKED_IMPLEMENTATION
+#ifndef ALLOCKIT_LOCKED_H_IMPL
+#define ALLOCKIT_LOCKED_H_IMPL
+
+#include <sched.h>
+#include <stdint.h>
+
+#if ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_FUTEX
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif  /* ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_FUTEX */
+
+#if defined(__x86_64__) || defined(__i386__)
+#  define ALLOCKIT_LOCKED_PAUSE() __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#  define ALLOCKIT_LOCKED_PAUSE() __asm__ __volatile__("yield")
+#else
+#  define ALLOCKIT_LOCKED_PAUSE() ((void)0)
+#endif  /* __x86_64__ || __i386__ */
+
+#if ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_SPIN
+
+static
+void
+akLockedAcquire(AkLockedLock *lock)
+{
+  unsigned int spins = 0, backoff = 1, i;
+
+  while (atomic_exchange_explicit(&lock->state, 1, memory_order_acquire)) {
+    /* Wait for the lock to look free before trying to take it again,
+       so that waiters don't steal the cache line from the holder. */
+    while (atomic_load_explicit(&lock->state, memory_order_relaxed)) {
+      if (spins < ALLOCKIT_LOCKED_SPINS) {
+        for (i = 0; i < backoff; i++)
+          ALLOCKIT_LOCKED_PAUSE();
+        if (backoff < 64)
+          backoff <<= 1;
+        spins++;
+      } else {
+        sched_yield();
+      }
+    }
+  }
+}
+
+static
+void
+akLockedRelease(AkLockedLock *lock)
+{
+  atomic_store_explicit(&lock->state, 0, memory_order_release);
+}
+
+static
+void
+akLockedLockInit(AkLockedLock *lock)
+{
+  atomic_init(&lock->state, 0);
+}
+
+#elif ALLOCKIT_LOCKED_LOCK == ALLOCKIT_LOCKED_TICKET
+
+static
+void
+akLockedAcquire(AkLockedLock *lock)
+{
+  unsigned int ticket, serving, spins = 0, i;
+
+  ticket = atomic_fetch_add_explicit(&lock->next, 1, memory_order_relaxed);
+  while ((serving = atomic_load_explicit(&lock->serving,
+                                         memory_order_acquire)) != ticket) {
+    /* Back off in proportion to the number of waiters ahead. */
+    if (spins < ALLOCKIT_LOCKED_SPINS) {
+      for (i = 0; i < ticket - serving; i++)
+        ALLOCKIT_LOCKED_PAUSE();
+      spins++;
+    } else {
+      sched_yield();
+    }
+  }
+}
+
+static
+void
+akLockedRelease(AkLockedLock *lock)
+{
+  atomic_store_explicit(&lock->serving,
+                        atomic_load_explicit(&lock->serving,
+                                             memory_order_relaxed) + 1,
+                        memory_order_release);
+}
+
+static
+void
+akLockedLockInit(AkLockedLock *lock)
+{
+  atomic_init(&lock->next, 0);
+  atomic_init(&lock->serving, 0);
+}
+
+#else
+
+/* The state is 0 when unlocked, 1 when locked, and 2 when locked with
+   possible sleepers, which the holder must wake on release. */
+
+static
+void
+akLockedFutex(AkLockedLock *lock, int op, int val)
+{
+  syscall(SYS_futex, &lock->state, op | FUTEX_PRIVATE_FLAG, val,
+          NULL, NULL, 0);
+}
+
+static
+void
+akLockedAcquire(AkLockedLock *lock)
+{
+  unsigned int spins;
+  int state = 0;
+
+  for (spins = 0; spins < ALLOCKIT_LOCKED_SPINS; spins++) {
+    state = 0;
+    if (atomic_compare_exchange_weak_explicit(&lock->state, &state, 1,
+                                              memory_order_acquire,
+                                              memory_order_relaxed))
+      return;
+    if (state == 2)
+      break;
+    ALLOCKIT_LOCKED_PAUSE();
+  }
+
+  while (atomic_exchange_explicit(&lock->state, 2, memory_order_acquire))
+    akLockedFutex(lock, FUTEX_WAIT, 2);
+}
+
+static
+void
+akLockedRelease(AkLockedLock *lock)
+{
+  if (atomic_exchange_explicit(&lock->state, 0, memory_order_release) == 2)
+    akLockedFutex(lock, FUTEX_WAKE, 1);
+}
+
+static
+void
+akLockedLockInit(AkLockedLock *lock)
+{
+  atomic_init(&lock->state, 0);
+}
+
+#endif  /* ALLOCKIT_LOCKED_LOCK */
+
+static
+void *
+akLockedAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+  void *addr;
+
+  akLockedAcquire(&locked->lock);
+  addr = ak_alloc_raw(locked->inner, size, align, count);
+  akLockedRelease(&locked->lock);
+
+  return addr;
+}
+
+static
+int
+akLockedResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+               ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+  int ok;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  akLockedAcquire(&locked->lock);
+  ok = ak_resize_raw(locked->inner, addr, size, align, count);
+  akLockedRelease(&locked->lock);
+
+  return ok;
+}
+
+static
+void
+akLockedFree(AkAlloc *alloc, void *addr)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+
+  akLockedAcquire(&locked->lock);
+  ak_free(locked->inner, addr);
+  akLockedRelease(&locked->lock);
+}
+
+static
+void
+akLockedFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                  ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+
+  akLockedAcquire(&locked->lock);
+  ak_free_sized_raw(locked->inner, addr, size, align, count);
+  akLockedRelease(&locked->lock);
+}
+
+static
+void *
+akLockedRemap(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+              ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T old_count,
+              ALLOCKIT_SIZE_T count)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+  void *new_addr;
+
+  akLockedAcquire(&locked->lock);
+  new_addr = ak_remap_raw(locked->inner, addr, size, align, old_count,
+                          count);
+  akLockedRelease(&locked->lock);
+
+  return new_addr;
+}
+
+static
+void *
+akLockedAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+  void *addr;
+
+  akLockedAcquire(&locked->lock);
+  addr = ak_alloc_ex_raw(locked->inner, size, align, count, usable);
+  akLockedRelease(&locked->lock);
+
+  return addr;
+}
+
+static
+ALLOCKIT_SIZE_T
+akLockedAllocBatch(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                   void **addrs, ALLOCKIT_SIZE_T n)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+  ALLOCKIT_SIZE_T got;
+
+  akLockedAcquire(&locked->lock);
+  got = ak_alloc_batch_raw(locked->inner, size, align, count, addrs, n);
+  akLockedRelease(&locked->lock);
+
+  return got;
+}
+
+static
+void
+akLockedFreeBatch(AkAlloc *alloc, void **addrs, ALLOCKIT_SIZE_T n,
+                  ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                  ALLOCKIT_SIZE_T count)
+{
+  AkLocked *locked = (AkLocked *)alloc;
+
+  akLockedAcquire(&locked->lock);
+  ak_free_batch_raw(locked->inner, addrs, n, size, align, count);
+  akLockedRelease(&locked->lock);
+}
+
+void
+ak_locked_init(AkLocked *locked, AkAlloc *inner)
+{
+  locked->alloc.alloc = akLockedAlloc;
+  locked->alloc.resize = akLockedResize;
+  locked->alloc.free = akLockedFree;
+  locked->alloc.free_sized = akLockedFreeSized;
+  locked->alloc.remap = akLockedRemap;
+  locked->alloc.alloc_ex = akLockedAllocEx;
+  locked->alloc.alloc_batch = akLockedAllocBatch;
+  locked->alloc.free_batch = akLockedFreeBatch;
+  locked->inner = inner;
+  akLockedLockInit(&locked->lock);
+}
+
+void
+ak_locked_deinit(AkLocked *locked)
+{
+  (void)locked;
+}
+
+#endif  /* !ALLOCKIT_LOCKED_H_IMPL */
+#endif  /* ALLOCKIT_LOCKED_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,354 @@
+/* ak_page.h - mmap-backed page allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_PAGE_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_page.h to emit the implementation. The implementation
+       requires POSIX `mmap` with MAP_ANONYMOUS, which must be
+       compiled with _DEFAULT_SOURCE or _GNU_SOURCE defined under a
+       strict -std=c11. When it is compiled with _GNU_SOURCE defined
+       on Linux, `mremap` is used to grow allocations in place.
+
+   USAGE
+
+       The page allocator takes memory directly from the operating
+       system with `mmap` and gives it back with `munmap`. Unlike the
+       other allocators it needs no initialization: it is a single
+       global allocator, `ak_page_allocator`, and is thread-safe.
+
+         #include "allockit.h"
+         #include "ak_page.h"
+
+         char *buf = ak_alloc(&ak_page_allocator, char, 1 << 20);
+         ...
+         ak_free(&ak_page_allocator, buf);
+
+       It is intended as the backing allocator for the other
+       allocators, and for large buffers. Every allocation is rounded
+       up to a whole number of pages, and a small header in front of
+       the returned address records the mapping, so small allocations
+       made directly from it are wasteful.
+
+         AkArena arena = {0};
+         ak_arena_init(&arena, &ak_page_allocator, 0);
+
+       `resize` shrinks an allocation by unmapping its trailing pages,
+       and on Linux grows it with `mremap` when the pages after it are
+       free. The allocation is never moved.
+
+       `ak_remap` on Linux lets `mremap` move the allocation when it
+       can't grow in place, so the kernel remaps the pages instead of
+       their contents being copied. This isn't possible for
+       allocations aligned to more than a page, which fall back to
+       copying.
+
+       Requests aligned to a page or more cost one extra page, which
+       holds the header.
+
+       `ak_alloc_ex` reports the rest of the last page as usable.
+
+       `ak_free_sized` works out the mapping from the size and
+       alignment it is passed, so it unmaps the allocation without
+       touching the header page.
+
+ */
+
+#ifndef ALLOCKIT_PAGE_H_DEFS
+#define ALLOCKIT_PAGE_H_DEFS
+
+#include "allockit.h"
+
+extern AkAlloc ak_page_allocator;
+
+#endif  /* !ALLOCKIT_PAGE_H_DEFS */
+
+#ifdef ALLOCKIT_PAGE_IMPLEMENTATION
+#ifndef ALLOCKIT_PAGE_H_IMPL
+#define ALLOCKIT_PAGE_H_IMPL
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+typedef struct AkPageHeader {
+  unsigned char *base;
+  ALLOCKIT_SIZE_T len;
+} AkPageHeader;
+
+static
+ALLOCKIT_SIZE_T
+akPageSize(void)
+{
+  return (ALLOCKIT_SIZE_T)sysconf(_SC_PAGESIZE);
+}
+
+static
+AkPageHeader *
+akPageHeaderOf(void *addr)
+{
+  return (AkPageHeader *)addr - 1;
+}
+
+/* Offset of the returned address from the start of the mapping. */
+static
+ALLOCKIT_SIZE_T
+akPageOffset(ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T page)
+{
+  if (align >= page)
+    return page;
+  return (sizeof(AkPageHeader) + align - 1) & ~(align - 1);
+}
+
+/* Rounds `offset + bytes` up to whole pages, returning 0 on
+   overflow. */
+static
+ALLOCKIT_SIZE_T
+akPageSpan(ALLOCKIT_SIZE_T offset, ALLOCKIT_SIZE_T bytes,
+           ALLOCKIT_SIZE_T page)
+{
+  if (bytes > (ALLOCKIT_SIZE_T)-1 - offset - (page - 1))
+    return 0;
+  return (offset + bytes + page - 1) & ~(page - 1);
+}
+
+static
+void *
+akPageAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  ALLOCKIT_SIZE_T page = akPageSize();
+  ALLOCKIT_SIZE_T offset, len, map_len;
+  unsigned char *map, *base;
+  AkPageHeader *header;
+
+  (void)alloc;
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  offset = akPageOffset(align, page);
+  len = akPageSpan(offset, size * count, page);
+  if (!len)
+    return NULL;
+
+  /* Over-map so that an aligned address can be found inside the
+     mapping, then trim the excess on both sides. */
+  map_len = len;
+  if (align > page) {
+    if (len > (ALLOCKIT_SIZE_T)-1 - align)
+      return NULL;
+    map_len += align;
+  }
+
+  map = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  base = map;
+  if (align > page) {
+    base = (unsigned char *)(((uintptr_t)map + offset + align - 1)
+                             & ~(uintptr_t)(align - 1)) - offset;
+    if (base != map)
+      munmap(map, (ALLOCKIT_SIZE_T)(base - map));
+    if (map + map_len != base + len)
+      munmap(base + len, (ALLOCKIT_SIZE_T)(map + map_len - (base + len)));
+  }
+
+  header = akPageHeaderOf(base + offset);
+  header->base = base;
+  header->len = len;
+  *usable = len - offset;
+  return base + offset;
+}
+
+static
+void *
+akPageAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+            ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akPageAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akPageResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T page = akPageSize();
+  AkPageHeader *header;
+  ALLOCKIT_SIZE_T offset, len;
+
+  (void)alloc;
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  header = akPageHeaderOf(addr);
+  offset = (ALLOCKIT_SIZE_T)((unsigned char *)addr - header->base);
+  len = akPageSpan(offset, size * count, page);
+  if (!len)
+    return 0;
+
+  if (len < header->len) {
+    munmap(header->base + len, header->len - len);
+  } else if (len > header->len) {
+#ifdef MREMAP_MAYMOVE
+    if (mremap(header->base, header->len, len, 0) == MAP_FAILED)
+      return 0;
+#else
+    return 0;
+#endif  /* MREMAP_MAYMOVE */
+  }
+
+  header->len = len;
+  return 1;
+}
+
+static
+void
+akPageFree(AkAlloc *alloc, void *addr)
+{
+  AkPageHeader *header;
+
+  (void)alloc;
+
+  if (!addr)
+    return;
+
+  header = akPageHeaderOf(addr);
+  munmap(header->base, header->len);
+}
+
+static
+void
+akPageFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T page = akPageSize();
+  ALLOCKIT_SIZE_T offset = akPageOffset(align, page);
+
+  (void)alloc;
+
+  if (!addr)
+    return;
+
+  munmap((unsigned char *)addr - offset,
+         akPageSpan(offset, size * count, page));
+}
+
+static
+void *
+akPageRemap(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+            ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T old_count,
+            ALLOCKIT_SIZE_T count)
+{
+#ifdef MREMAP_MAYMOVE
+  ALLOCKIT_SIZE_T page = akPageSize();
+  AkPageHeader *header;
+  ALLOCKIT_SIZE_T offset, len;
+  unsigned char *map;
+
+  /* A moved mapping is only guaranteed to be page-aligned. */
+  if (!addr || align > page)
+    return ak_remap_fallback(alloc, addr, size, align, old_count, count);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  header = akPageHeaderOf(addr);
+  offset = (ALLOCKIT_SIZE_T)((unsigned char *)addr - header->base);
+  len = akPageSpan(offset, size * count, page);
+  if (!len)
+    return NULL;
+
+  if (len <= header->len)
+    return akPageResize(alloc, addr, size, align, count) ? addr : NULL;
+
+  map = mremap(header->base, header->len, len, MREMAP_MAYMOVE);
+  if (map == MAP_FAILED)
+    return NULL;
+
+  header = akPageHeaderOf(map + offset);
+  header->base = map;
+  header->len = len;
+  return map + offset;
+#else
+  return ak_remap_fallback(alloc, addr, size, align, old_count, count);
+#endif  /* MREMAP_MAYMOVE */
+}
+
+AkAlloc ak_page_allocator = {
+  akPageAlloc,
+  akPageResize,
+  akPageFree,
+  akPageFreeSized,
+  akPageRemap,
+  akPageAllocEx,
+  NULL,
+  NULL
+};
+
+#endif  /* !ALLOCKIT_PAGE_H_IMPL */
+#endif  /* ALLOCKIT_PAGE_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
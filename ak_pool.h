@@ -0,0 +1,370 @@
+/* ak_pool.h - fixed-size object pool for AllocKit
+
+   FLAGS
+     ALLOCKIT_POOL_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_pool.h to emit the implementation.
+
+   USAGE
+
+       A pool hands out slots of a single size and alignment, chosen
+       when the pool is initialized. Since every slot is the same
+       size, there is no size-class lookup: getting a slot pops it off
+       a free list and putting it back pushes it on again.
+
+         #include "allockit.h"
+         #include "ak_pool.h"
+
+         AkPool pool = {0};
+         if (!ak_pool_init(&pool, backing, sizeof(Conn),
+                           ALLOCKIT_ALIGNOF(Conn), 1024))
+           return -1;
+
+       `ak_pool_init` reserves room for `count` slots up front, in one
+       contiguous block from the backing allocator, and returns 0 if
+       that fails. When the pool runs out, it reserves another block
+       of the same number of slots.
+
+       Slots can be taken with the typed `ak_pool_get` macro and
+       returned with `ak_pool_put`, which skip the `AkAlloc` function
+       pointers entirely.
+
+         Conn *conn = ak_pool_get(&pool, Conn);
+         ...
+         ak_pool_put(&pool, conn);
+
+       The pool can also be passed anywhere an `AkAlloc *` is
+       expected. Through that interface, `alloc` fails for any request
+       that is larger than a slot or more strictly aligned than the
+       pool, and `resize` succeeds whenever the new size still fits in
+       a slot. `ak_alloc_ex` reports the whole slot as usable, and
+       `ak_alloc_batch` and `ak_free_batch` pop or push a whole batch
+       of slots at once.
+
+         Conn *conn = ak_alloc(&pool.alloc, Conn, 1);
+
+       `ak_pool_deinit` returns every block to the backing allocator.
+
+         ak_pool_deinit(&pool);
+
+       The pool is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_POOL_H_DEFS
+#define ALLOCKIT_POOL_H_DEFS
+
+#include "allockit.h"
+
+typedef struct AkPoolBlock {
+  struct AkPoolBlock *next;
+} AkPoolBlock;
+
+typedef struct AkPool {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  ALLOCKIT_SIZE_T size;
+  ALLOCKIT_SIZE_T align;
+  ALLOCKIT_SIZE_T count;
+  void *free;
+  unsigned char *bump;
+  unsigned char *end;
+  AkPoolBlock *blocks;
+} AkPool;
+
+int ak_pool_init(AkPool *pool, AkAlloc *backing, ALLOCKIT_SIZE_T size,
+                 ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count);
+void ak_pool_deinit(AkPool *pool);
+
+void *ak_pool_get_raw(AkPool *pool);
+void ak_pool_put(AkPool *pool, void *addr);
+
+static inline
+void *
+ak_pool_get_sized(AkPool *pool, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align)
+{
+  ALLOCKIT_ASSERT(size <= pool->size && align <= pool->align);
+  return ak_pool_get_raw(pool);
+}
+
+#define ak_pool_get(pPool, T) \
+  ((T *)ak_pool_get_sized(pPool, sizeof(T), ALLOCKIT_ALIGNOF(T)))
+
+#endif  /* !ALLOCKIT_POOL_H_DEFS */
+
+#ifdef ALLOCKIT_POOL_IMPLEMENTATION
+#ifndef ALLOCKIT_POOL_H_IMPL
+#define ALLOCKIT_POOL_H_IMPL
+
+#include <stdint.h>
+
+/* Slots are laid out after the block header, at the first offset
+   aligned to the slot alignment. */
+static
+ALLOCKIT_SIZE_T
+akPoolSlotOffset(AkPool *pool)
+{
+  return (sizeof(AkPoolBlock) + pool->align - 1) & ~(pool->align - 1);
+}
+
+static
+int
+akPoolReserve(AkPool *pool)
+{
+  ALLOCKIT_SIZE_T offset = akPoolSlotOffset(pool);
+  AkPoolBlock *block;
+
+  if (pool->size > ((ALLOCKIT_SIZE_T)-1 - offset) / pool->count)
+    return 0;
+
+  block = ak_alloc_raw(pool->backing, offset + pool->size * pool->count,
+                       pool->align, 1);
+  if (!block)
+    return 0;
+
+  block->next = pool->blocks;
+  pool->blocks = block;
+  pool->bump = (unsigned char *)block + offset;
+  pool->end = pool->bump + pool->size * pool->count;
+  return 1;
+}
+
+void *
+ak_pool_get_raw(AkPool *pool)
+{
+  void *slot = pool->free;
+
+  if (slot) {
+    pool->free = *(void **)slot;
+    return slot;
+  }
+
+  if (pool->bump == pool->end && !akPoolReserve(pool))
+    return NULL;
+
+  slot = pool->bump;
+  pool->bump += pool->size;
+  return slot;
+}
+
+void
+ak_pool_put(AkPool *pool, void *addr)
+{
+  if (!addr)
+    return;
+
+  *(void **)addr = pool->free;
+  pool->free = addr;
+}
+
+static
+void *
+akPoolAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkPool *pool = (AkPool *)alloc;
+  void *slot;
+
+  if (count && size > pool->size / count)
+    return NULL;
+  if (align > pool->align)
+    return NULL;
+
+  slot = ak_pool_get_raw(pool);
+  if (slot)
+    *usable = pool->size;
+  return slot;
+}
+
+static
+void *
+akPoolAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+            ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akPoolAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akPoolResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkPool *pool = (AkPool *)alloc;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+
+  return !count || size <= pool->size / count;
+}
+
+static
+ALLOCKIT_SIZE_T
+akPoolAllocBatch(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                 ALLOCKIT_SIZE_T count, void **addrs, ALLOCKIT_SIZE_T n)
+{
+  AkPool *pool = (AkPool *)alloc;
+  void *slot;
+  ALLOCKIT_SIZE_T i;
+
+  if (count && size > pool->size / count)
+    return 0;
+  if (align > pool->align)
+    return 0;
+
+  slot = pool->free;
+  for (i = 0; i < n && slot; i++) {
+    addrs[i] = slot;
+    slot = *(void **)slot;
+  }
+  pool->free = slot;
+
+  for (; i < n; i++) {
+    addrs[i] = ak_pool_get_raw(pool);
+    if (!addrs[i])
+      break;
+  }
+
+  return i;
+}
+
+static
+void
+akPoolFreeBatch(AkAlloc *alloc, void **addrs, ALLOCKIT_SIZE_T n,
+                ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                ALLOCKIT_SIZE_T count)
+{
+  AkPool *pool = (AkPool *)alloc;
+  void *head = pool->free;
+  ALLOCKIT_SIZE_T i;
+
+  (void)size;
+  (void)align;
+  (void)count;
+
+  for (i = 0; i < n; i++) {
+    if (!addrs[i])
+      continue;
+    *(void **)addrs[i] = head;
+    head = addrs[i];
+  }
+  pool->free = head;
+}
+
+static
+void
+akPoolFree(AkAlloc *alloc, void *addr)
+{
+  ak_pool_put((AkPool *)alloc, addr);
+}
+
+int
+ak_pool_init(AkPool *pool, AkAlloc *backing, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (align < ALLOCKIT_ALIGNOF(void *))
+    align = ALLOCKIT_ALIGNOF(void *);
+  if (size < sizeof(void *))
+    size = sizeof(void *);
+  if (size > (ALLOCKIT_SIZE_T)-1 - (align - 1))
+    return 0;
+
+  pool->alloc.alloc = akPoolAlloc;
+  pool->alloc.resize = akPoolResize;
+  pool->alloc.free = akPoolFree;
+  pool->alloc.free_sized = NULL;
+  pool->alloc.remap = NULL;
+  pool->alloc.alloc_ex = akPoolAllocEx;
+  pool->alloc.alloc_batch = akPoolAllocBatch;
+  pool->alloc.free_batch = akPoolFreeBatch;
+  pool->backing = backing;
+  pool->size = (size + align - 1) & ~(align - 1);
+  pool->align = align;
+  pool->count = count ? count : 1;
+  pool->free = NULL;
+  pool->bump = NULL;
+  pool->end = NULL;
+  pool->blocks = NULL;
+
+  return akPoolReserve(pool);
+}
+
+void
+ak_pool_deinit(AkPool *pool)
+{
+  AkPoolBlock *block = pool->blocks;
+
+  while (block) {
+    AkPoolBlock *next = block->next;
+    ak_free(pool->backing, block);
+    block = next;
+  }
+
+  pool->free = NULL;
+  pool->bump = NULL;
+  pool->end = NULL;
+  pool->blocks = NULL;
+}
+
+#endif  /* !ALLOCKIT_POOL_H_IMPL */
+#endif  /* ALLOCKIT_POOL_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,357 @@
+/* ak_ring.h - ring buffer allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_RING_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_ring.h to emit the implementation.
+
+   USAGE
+
+       A ring allocator serves allocations out of a caller-provided
+       buffer in first-in, first-out order. Allocating bumps the head
+       of the ring, wrapping around to the start of the buffer when it
+       reaches the end, and freeing the oldest allocation advances the
+       tail. This suits queues, where messages are freed in the order
+       they arrived: every allocation is a bump, there are no free
+       lists, and the memory in use stays in one contiguous window
+       that moves around the buffer.
+
+         #include "allockit.h"
+         #include "ak_ring.h"
+
+         static unsigned char buf[1 << 20];
+         AkRing ring = {0};
+         ak_ring_init(&ring, buf, sizeof(buf));
+
+         Msg *msg = ak_alloc(&ring.alloc, Msg, 1);
+         enqueue(queue, msg);
+         ...
+         ak_free(&ring.alloc, dequeue(queue));
+
+       Allocations may still be freed out of order. An allocation that
+       isn't the oldest is only marked as freed, and its space is
+       reclaimed once every allocation before it has been freed too,
+       so one long-lived allocation holds up the reuse of everything
+       after it.
+
+       Each allocation takes a header of 2 * sizeof(void *) bytes, and
+       is rounded up to a multiple of that size. When an allocation
+       doesn't fit before the end of the buffer, the rest of the
+       buffer is skipped until the tail passes it. `alloc` returns NULL
+       when the ring is full.
+
+       `resize` succeeds for the most recent allocation while it fits
+       in the space after it, and fails for any other. `ak_alloc_ex`
+       reports the rounded-up size as usable.
+
+       `ak_ring_reset` releases every allocation at once. There is no
+       deinit function, as the allocator holds no resources of its own.
+
+         ak_ring_reset(&ring);
+
+       The ring allocator is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_RING_H_DEFS
+#define ALLOCKIT_RING_H_DEFS
+
+#include "allockit.h"
+
+typedef struct AkRingHeader {
+  ALLOCKIT_SIZE_T len;
+  ALLOCKIT_SIZE_T freed;
+} AkRingHeader;
+
+typedef struct AkRing {
+  AkAlloc alloc;
+  unsigned char *start;
+  unsigned char *end;
+  unsigned char *head;
+  unsigned char *tail;
+  AkRingHeader *last;
+  ALLOCKIT_SIZE_T used;
+} AkRing;
+
+void ak_ring_init(AkRing *ring, void *buf, ALLOCKIT_SIZE_T size);
+void ak_ring_reset(AkRing *ring);
+
+#endif  /* !ALLOCKIT_RING_H_DEFS */
+
+#ifdef ALLOCKIT_RING_IMPLEMENTATION
+#ifndef ALLOCKIT_RING_H_IMPL
+#define ALLOCKIT_RING_H_IMPL
+
+#include <stdint.h>
+
+/* The ring is a sequence of blocks from the tail to the head, each
+   starting with a header that holds its length, header included. An
+   allocation's header sits right before the returned address. Any
+   padding needed to align it, and the space skipped at the end of the
+   buffer when the ring wraps, are blocks of their own that are freed
+   from the start. Every block starts on a multiple of the header
+   size, so the padding is always large enough for a header. */
+#define ALLOCKIT_RING_UNIT sizeof(AkRingHeader)
+
+static
+ALLOCKIT_SIZE_T
+akRingRoundUp(ALLOCKIT_SIZE_T bytes)
+{
+  return (bytes + ALLOCKIT_RING_UNIT - 1) & ~(ALLOCKIT_RING_UNIT - 1);
+}
+
+/* Returns the space needed for a header and `bytes` bytes aligned to
+   `align`, placed at `at`, and sets `pad` to the padding in front. */
+static
+ALLOCKIT_SIZE_T
+akRingNeed(unsigned char *at, ALLOCKIT_SIZE_T bytes, ALLOCKIT_SIZE_T align,
+           ALLOCKIT_SIZE_T *pad)
+{
+  uintptr_t data = (uintptr_t)at + ALLOCKIT_RING_UNIT;
+
+  *pad = (ALLOCKIT_SIZE_T)(((data + align - 1) & ~(uintptr_t)(align - 1))
+                           - data);
+  return *pad + ALLOCKIT_RING_UNIT + bytes;
+}
+
+/* Writes a block that is freed from the start. */
+static
+void
+akRingSkip(AkRing *ring, ALLOCKIT_SIZE_T len)
+{
+  AkRingHeader *header = (AkRingHeader *)ring->head;
+
+  header->len = len;
+  header->freed = 1;
+  ring->head += len;
+  ring->used += len;
+}
+
+/* Reclaims freed blocks from the tail onwards. */
+static
+void
+akRingAdvance(AkRing *ring)
+{
+  AkRingHeader *header;
+
+  while (ring->used) {
+    if (ring->tail == ring->end)
+      ring->tail = ring->start;
+    header = (AkRingHeader *)ring->tail;
+    if (!header->freed)
+      return;
+    ring->tail += header->len;
+    ring->used -= header->len;
+  }
+
+  /* Start again from the beginning of the buffer when the ring
+     empties, so that the next allocation has all of it. */
+  ak_ring_reset(ring);
+}
+
+static
+void *
+akRingAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkRing *ring = (AkRing *)alloc;
+  AkRingHeader *header;
+  ALLOCKIT_SIZE_T bytes, pad, need;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (size * count > (ALLOCKIT_SIZE_T)(ring->end - ring->start))
+    return NULL;
+  if (align > (ALLOCKIT_SIZE_T)(ring->end - ring->start))
+    return NULL;
+  bytes = akRingRoundUp(size * count);
+  if (align < ALLOCKIT_RING_UNIT)
+    align = ALLOCKIT_RING_UNIT;
+
+  if (ring->used == (ALLOCKIT_SIZE_T)(ring->end - ring->start))
+    return NULL;
+
+  need = akRingNeed(ring->head, bytes, align, &pad);
+  if (ring->head < ring->tail) {
+    if (need > (ALLOCKIT_SIZE_T)(ring->tail - ring->head))
+      return NULL;
+  } else if (need > (ALLOCKIT_SIZE_T)(ring->end - ring->head)) {
+    /* Doesn't fit before the end of the buffer, so skip the rest of it
+       and wrap around to the space in front of the tail. */
+    need = akRingNeed(ring->start, bytes, align, &pad);
+    if (need > (ALLOCKIT_SIZE_T)(ring->tail - ring->start))
+      return NULL;
+    if (ring->head != ring->end)
+      akRingSkip(ring, (ALLOCKIT_SIZE_T)(ring->end - ring->head));
+    ring->head = ring->start;
+  }
+
+  if (pad)
+    akRingSkip(ring, pad);
+
+  header = (AkRingHeader *)ring->head;
+  header->len = ALLOCKIT_RING_UNIT + bytes;
+  header->freed = 0;
+  ring->head += header->len;
+  ring->used += header->len;
+  ring->last = header;
+
+  *usable = bytes;
+  return header + 1;
+}
+
+static
+void *
+akRingAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+            ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akRingAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akRingResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkRing *ring = (AkRing *)alloc;
+  AkRingHeader *header;
+  unsigned char *limit;
+  ALLOCKIT_SIZE_T bytes;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  header = (AkRingHeader *)addr - 1;
+  if (header != ring->last)
+    return 0;
+
+  limit = ring->head > ring->tail ? ring->end : ring->tail;
+  if (size * count > (ALLOCKIT_SIZE_T)(limit - (unsigned char *)addr))
+    return 0;
+  bytes = akRingRoundUp(size * count);
+
+  ring->used -= header->len;
+  ring->head -= header->len;
+  header->len = ALLOCKIT_RING_UNIT + bytes;
+  ring->used += header->len;
+  ring->head += header->len;
+  return 1;
+}
+
+static
+void
+akRingFree(AkAlloc *alloc, void *addr)
+{
+  AkRing *ring = (AkRing *)alloc;
+  AkRingHeader *header;
+
+  if (!addr)
+    return;
+
+  header = (AkRingHeader *)addr - 1;
+  header->freed = 1;
+  if (header == ring->last)
+    ring->last = NULL;
+
+  akRingAdvance(ring);
+}
+
+void
+ak_ring_init(AkRing *ring, void *buf, ALLOCKIT_SIZE_T size)
+{
+  uintptr_t start = (uintptr_t)buf, end = start + size;
+
+  ring->alloc.alloc = akRingAlloc;
+  ring->alloc.resize = akRingResize;
+  ring->alloc.free = akRingFree;
+  ring->alloc.free_sized = NULL;
+  ring->alloc.remap = NULL;
+  ring->alloc.alloc_ex = akRingAllocEx;
+  ring->alloc.alloc_batch = NULL;
+  ring->alloc.free_batch = NULL;
+
+  start = (start + ALLOCKIT_RING_UNIT - 1)
+          & ~(uintptr_t)(ALLOCKIT_RING_UNIT - 1);
+  end &= ~(uintptr_t)(ALLOCKIT_RING_UNIT - 1);
+  if (end < start)
+    end = start;
+
+  ring->start = (unsigned char *)start;
+  ring->end = (unsigned char *)end;
+  ak_ring_reset(ring);
+}
+
+void
+ak_ring_reset(AkRing *ring)
+{
+  ring->head = ring->start;
+  ring->tail = ring->start;
+  ring->last = NULL;
+  ring->used = 0;
+}
+
+#endif  /* !ALLOCKIT_RING_H_IMPL */
+#endif  /* ALLOCKIT_RING_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,374 @@
+/* ak_sharded.h - thread-safe sharding combinator for AllocKit
+
+   FLAGS
+     ALLOCKIT_SHARDED_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_sharded.h to emit the implementation. The implementation
+       requires POSIX threads and C11 atomics.
+
+   USAGE
+
+       A sharded allocator makes any allocator thread-safe, and lets
+       it scale across cores, by holding several independent instances
+       of it, each behind its own mutex. Threads are spread over the
+       instances, so that most of the time each one only ever takes a
+       lock nobody else is holding.
+
+         #include "allockit.h"
+         #include "ak_page.h"
+         #include "ak_slab.h"
+         #include "ak_sharded.h"
+
+         AkSlab slabs[8];
+         AkAlloc *shards[8];
+         AkSharded sharded = {0};
+
+         for (i = 0; i < 8; i++) {
+           ak_slab_init(&slabs[i], &ak_page_allocator);
+           shards[i] = &slabs[i].alloc;
+         }
+         if (!ak_sharded_init(&sharded, backing, shards, 8))
+           return -1;
+
+         do_work_on_many_threads(&sharded.alloc);
+
+       `ak_sharded_init` copies the array of shards, and takes room for
+       their locks from `backing`, which is only used by
+       `ak_sharded_init` and `ak_sharded_deinit`. The shards themselves
+       remain owned by the caller.
+
+       Each thread is given a home shard the first time it allocates,
+       in round-robin order. An allocation first tries the home shard's
+       lock, then tries each of the others in turn, and only waits for
+       the home shard if they are all busy.
+
+       Since memory may be freed by a different thread than the one
+       that allocated it, each allocation records the shard it came
+       from in a small header in front of the returned address, so that
+       `free` and `resize` go back to the same shard. The header takes
+       two words, rounded up to the allocation's alignment, which makes
+       the sharded allocator a poor fit for very small objects.
+
+       `ak_free_sized` and `ak_alloc_ex` are passed through to the
+       shard, with the header taken into account.
+
+       `ak_sharded_deinit` releases the locks. The shards are not
+       touched, and should be deinitialized by the caller afterwards.
+
+         ak_sharded_deinit(&sharded);
+         for (i = 0; i < 8; i++)
+           ak_slab_deinit(&slabs[i]);
+
+ */
+
+#ifndef ALLOCKIT_SHARDED_H_DEFS
+#define ALLOCKIT_SHARDED_H_DEFS
+
+#include <pthread.h>
+
+#include "allockit.h"
+
+typedef struct AkShardedShard {
+  pthread_mutex_t lock;
+  AkAlloc *alloc;
+} AkShardedShard;
+
+typedef struct AkSharded {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  AkShardedShard *shards;
+  unsigned int count;
+} AkSharded;
+
+int ak_sharded_init(AkSharded *sharded, AkAlloc *backing, AkAlloc **shards,
+                    unsigned int count);
+void ak_sharded_deinit(AkSharded *sharded);
+
+#endif  /* !ALLOCKIT_SHARDED_H_DEFS */
+
+#ifdef ALLOCKIT_SHARDED_IMPLEMENTATION
+#ifndef ALLOCKIT_SHARDED_H_IMPL
+#define ALLOCKIT_SHARDED_H_IMPL
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct AkShardedHeader {
+  unsigned char *base;
+  ALLOCKIT_SIZE_T shard;
+} AkShardedHeader;
+
+static atomic_uint akShardedNextThread;
+static _Thread_local unsigned int akShardedThread;
+
+static
+AkShardedHeader *
+akShardedHeaderOf(void *addr)
+{
+  return (AkShardedHeader *)addr - 1;
+}
+
+/* Alignment that the shard is asked for, so that the header in front
+   of the returned address is aligned too. */
+static
+ALLOCKIT_SIZE_T
+akShardedAlign(ALLOCKIT_SIZE_T align)
+{
+  if (align < ALLOCKIT_ALIGNOF(AkShardedHeader))
+    return ALLOCKIT_ALIGNOF(AkShardedHeader);
+  return align;
+}
+
+/* Offset of the returned address from the start of the shard's
+   allocation. */
+static
+ALLOCKIT_SIZE_T
+akShardedOffset(ALLOCKIT_SIZE_T align)
+{
+  return (sizeof(AkShardedHeader) + align - 1) & ~(align - 1);
+}
+
+/* Locks and returns a shard, preferring the calling thread's home
+   shard and then any shard that isn't busy. */
+static
+AkShardedShard *
+akShardedLock(AkSharded *sharded)
+{
+  unsigned int home, i;
+
+  if (!akShardedThread)
+    akShardedThread = atomic_fetch_add_explicit(&akShardedNextThread, 1,
+                                                memory_order_relaxed) + 1;
+  home = (akShardedThread - 1) % sharded->count;
+
+  for (i = 0; i < sharded->count; i++) {
+    AkShardedShard *shard = &sharded->shards[(home + i) % sharded->count];
+
+    if (pthread_mutex_trylock(&shard->lock) == 0)
+      return shard;
+  }
+
+  pthread_mutex_lock(&sharded->shards[home].lock);
+  return &sharded->shards[home];
+}
+
+static
+void *
+akShardedAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                 ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkSharded *sharded = (AkSharded *)alloc;
+  AkShardedShard *shard;
+  AkShardedHeader *header;
+  ALLOCKIT_SIZE_T offset, got;
+  unsigned char *base;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  align = akShardedAlign(align);
+  offset = akShardedOffset(align);
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - offset)
+    return NULL;
+
+  shard = akShardedLock(sharded);
+  base = ak_alloc_ex_raw(shard->alloc, offset + size * count, align, 1, &got);
+  pthread_mutex_unlock(&shard->lock);
+
+  if (!base)
+    return NULL;
+
+  header = akShardedHeaderOf(base + offset);
+  header->base = base;
+  header->shard = (ALLOCKIT_SIZE_T)(shard - sharded->shards);
+  *usable = got - offset;
+  return base + offset;
+}
+
+static
+void *
+akShardedAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+               ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akShardedAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akShardedResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkSharded *sharded = (AkSharded *)alloc;
+  AkShardedShard *shard;
+  ALLOCKIT_SIZE_T offset;
+  int ok;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  align = akShardedAlign(align);
+  offset = akShardedOffset(align);
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - offset)
+    return 0;
+
+  shard = &sharded->shards[akShardedHeaderOf(addr)->shard];
+  pthread_mutex_lock(&shard->lock);
+  ok = ak_resize_raw(shard->alloc, (unsigned char *)addr - offset,
+                     offset + size * count, align, 1);
+  pthread_mutex_unlock(&shard->lock);
+
+  return ok;
+}
+
+static
+void
+akShardedFree(AkAlloc *alloc, void *addr)
+{
+  AkSharded *sharded = (AkSharded *)alloc;
+  AkShardedHeader *header;
+  AkShardedShard *shard;
+
+  if (!addr)
+    return;
+
+  header = akShardedHeaderOf(addr);
+  shard = &sharded->shards[header->shard];
+  pthread_mutex_lock(&shard->lock);
+  ak_free(shard->alloc, header->base);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+static
+void
+akShardedFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkSharded *sharded = (AkSharded *)alloc;
+  AkShardedShard *shard;
+  ALLOCKIT_SIZE_T offset;
+
+  if (!addr)
+    return;
+
+  align = akShardedAlign(align);
+  offset = akShardedOffset(align);
+
+  shard = &sharded->shards[akShardedHeaderOf(addr)->shard];
+  pthread_mutex_lock(&shard->lock);
+  ak_free_sized_raw(shard->alloc, (unsigned char *)addr - offset,
+                    offset + size * count, align, 1);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+int
+ak_sharded_init(AkSharded *sharded, AkAlloc *backing, AkAlloc **shards,
+                unsigned int count)
+{
+  unsigned int i;
+
+  ALLOCKIT_ASSERT(count);
+
+  sharded->alloc.alloc = akShardedAlloc;
+  sharded->alloc.resize = akShardedResize;
+  sharded->alloc.free = akShardedFree;
+  sharded->alloc.free_sized = akShardedFreeSized;
+  sharded->alloc.remap = NULL;
+  sharded->alloc.alloc_ex = akShardedAllocEx;
+  sharded->alloc.alloc_batch = NULL;
+  sharded->alloc.free_batch = NULL;
+  sharded->backing = backing;
+  sharded->count = count;
+
+  sharded->shards = ak_alloc(backing, AkShardedShard, count);
+  if (!sharded->shards)
+    return 0;
+
+  for (i = 0; i < count; i++) {
+    pthread_mutex_init(&sharded->shards[i].lock, NULL);
+    sharded->shards[i].alloc = shards[i];
+  }
+
+  return 1;
+}
+
+void
+ak_sharded_deinit(AkSharded *sharded)
+{
+  unsigned int i;
+
+  if (!sharded->shards)
+    return;
+
+  for (i = 0; i < sharded->count; i++)
+    pthread_mutex_destroy(&sharded->shards[i].lock);
+
+  ak_free_sized(sharded->backing, sharded->shards, AkShardedShard,
+                sharded->count);
+  sharded->shards = NULL;
+}
+
+#endif  /* !ALLOCKIT_SHARDED_H_IMPL */
+#endif  /* ALLOCKIT_SHARDED_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
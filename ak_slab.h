@@ -0,0 +1,474 @@
+/* ak_slab.h - size-class slab allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_SLAB_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_slab.h to emit the implementation.
+
+     ALLOCKIT_SLAB_SIZE (default: 65536)
+       Size in bytes of each slab requested from the backing
+       allocator. Must be a power of two larger than 4096. Slabs are
+       requested aligned to their own size.
+
+   USAGE
+
+       The slab allocator is a general-purpose allocator for small
+       objects. Every request of up to ALLOCKIT_SLAB_MAX_SIZE (2048)
+       bytes is rounded up to one of a fixed table of size classes,
+       and each class is served from slabs carved into equally sized
+       blocks. Freed blocks are kept on an intrusive free list per
+       class, so both `alloc` and `free` are a table lookup and a
+       pointer push or pop in the common case.
+
+         #include "allockit.h"
+         #include "ak_slab.h"
+
+         AkSlab slab = {0};
+         ak_slab_init(&slab, backing);
+
+         struct Node *node = ak_alloc(&slab.alloc, struct Node, 1);
+         ...
+         ak_free(&slab.alloc, node);
+
+       Requests larger than ALLOCKIT_SLAB_MAX_SIZE, or aligned to more
+       than ALLOCKIT_SLAB_MAX_ALIGN (64) bytes, are passed through to
+       the backing allocator, aligned to ALLOCKIT_SLAB_SIZE so that
+       `free` can tell them apart from blocks inside a slab. These
+       must be freed before calling `ak_slab_deinit`.
+
+       `resize` succeeds for a small allocation whenever the new size
+       maps to the same size class, and is forwarded to the backing
+       allocator for large allocations that stay large.
+
+       `ak_free_sized` finds the size class from the size it is
+       passed, without reading the slab header.
+
+       `ak_alloc_ex` reports the full size of the block's size class
+       as usable.
+
+       `ak_alloc_batch` and `ak_free_batch` look up the size class
+       once, and then pop or push the whole batch on its free list.
+
+       Slabs are only returned to the backing allocator by
+       `ak_slab_deinit`.
+
+           ak_slab_deinit(&slab);
+
+       The slab allocator is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_SLAB_H_DEFS
+#define ALLOCKIT_SLAB_H_DEFS
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_SLAB_SIZE
+#  define ALLOCKIT_SLAB_SIZE 65536
+#endif  /* !ALLOCKIT_SLAB_SIZE */
+
+#define ALLOCKIT_SLAB_CLASSES 24
+#define ALLOCKIT_SLAB_MAX_SIZE 2048
+#define ALLOCKIT_SLAB_MAX_ALIGN 64
+
+typedef struct AkSlabPage {
+  struct AkSlabPage *next;
+  unsigned int cls;
+} AkSlabPage;
+
+typedef struct AkSlabClass {
+  void *free;
+  unsigned char *bump;
+  unsigned char *end;
+} AkSlabClass;
+
+typedef struct AkSlab {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  AkSlabPage *pages;
+  AkSlabClass classes[ALLOCKIT_SLAB_CLASSES];
+} AkSlab;
+
+void ak_slab_init(AkSlab *slab, AkAlloc *backing);
+void ak_slab_deinit(AkSlab *slab);
+
+#endif  /* !ALLOCKIT_SLAB_H_DEFS */
+
+#ifdef ALLOCKIT_SLAB_IMPLEMENTATION
+#ifndef ALLOCKIT_SLAB_H_IMPL
+#define ALLOCKIT_SLAB_H_IMPL
+
+#include <stdint.h>
+
+/* Blocks start this far into a slab, which keeps the page header
+   out of the way and every block aligned to the largest power of
+   two dividing its class size, up to ALLOCKIT_SLAB_MAX_ALIGN. */
+#define ALLOCKIT_SLAB_HEADER_SIZE ALLOCKIT_SLAB_MAX_ALIGN
+
+static const unsigned short akSlabClassSize[ALLOCKIT_SLAB_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* Indexed by (bytes + 15) >> 4. */
+static const unsigned char akSlabClassIndex[] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11,
+  11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+  15, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17,
+  17, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19,
+  19, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+  20, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+  21, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+  22, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+  23
+};
+
+/* Returns the size class for an allocation, or -1 if it must be
+   passed through to the backing allocator. */
+static
+int
+akSlabClassOf(ALLOCKIT_SIZE_T bytes, ALLOCKIT_SIZE_T align)
+{
+  unsigned int cls;
+
+  if (bytes > ALLOCKIT_SLAB_MAX_SIZE || align > ALLOCKIT_SLAB_MAX_ALIGN)
+    return -1;
+
+  cls = akSlabClassIndex[(bytes + 15) >> 4];
+  while (akSlabClassSize[cls] % align)
+    cls++;
+
+  return (int)cls;
+}
+
+static
+AkSlabPage *
+akSlabPageOf(void *addr)
+{
+  return (AkSlabPage *)((uintptr_t)addr
+                        & ~(uintptr_t)(ALLOCKIT_SLAB_SIZE - 1));
+}
+
+static
+int
+akSlabIsLarge(void *addr)
+{
+  return ((uintptr_t)addr & (ALLOCKIT_SLAB_SIZE - 1)) == 0;
+}
+
+static
+ALLOCKIT_SIZE_T
+akSlabLargeAlign(ALLOCKIT_SIZE_T align)
+{
+  return align > ALLOCKIT_SLAB_SIZE ? align : ALLOCKIT_SLAB_SIZE;
+}
+
+static
+void *
+akSlabRefill(AkSlab *slab, unsigned int cls)
+{
+  AkSlabClass *c = &slab->classes[cls];
+  AkSlabPage *page;
+  unsigned char *base;
+  ALLOCKIT_SIZE_T size = akSlabClassSize[cls];
+
+  if (c->bump == c->end) {
+    page = ak_alloc_raw(slab->backing, ALLOCKIT_SLAB_SIZE,
+                        ALLOCKIT_SLAB_SIZE, 1);
+    if (!page)
+      return NULL;
+
+    page->next = slab->pages;
+    page->cls = cls;
+    slab->pages = page;
+
+    base = (unsigned char *)page;
+    c->bump = base + ALLOCKIT_SLAB_HEADER_SIZE;
+    c->end = base + ALLOCKIT_SLAB_SIZE
+      - (ALLOCKIT_SLAB_SIZE - ALLOCKIT_SLAB_HEADER_SIZE) % size;
+  }
+
+  base = c->bump;
+  c->bump += size;
+  return base;
+}
+
+static
+void *
+akSlabAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkSlab *slab = (AkSlab *)alloc;
+  AkSlabClass *c;
+  void *block;
+  int cls;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  cls = akSlabClassOf(size * count, align);
+  if (cls < 0)
+    return ak_alloc_ex_raw(slab->backing, size * count,
+                           akSlabLargeAlign(align), 1, usable);
+
+  c = &slab->classes[cls];
+  block = c->free;
+  if (block)
+    c->free = *(void **)block;
+  else
+    block = akSlabRefill(slab, (unsigned int)cls);
+
+  if (block)
+    *usable = akSlabClassSize[cls];
+  return block;
+}
+
+static
+void *
+akSlabAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+            ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akSlabAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akSlabResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkSlab *slab = (AkSlab *)alloc;
+  int cls;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  /* An allocation never changes size class, so that `free_sized`
+     can recover the class from the size alone. */
+  cls = akSlabClassOf(size * count, align);
+
+  if (akSlabIsLarge(addr))
+    return cls < 0
+      && ak_resize_raw(slab->backing, addr, size * count,
+                       akSlabLargeAlign(align), 1);
+
+  return (unsigned int)cls == akSlabPageOf(addr)->cls;
+}
+
+static
+void
+akSlabFree(AkAlloc *alloc, void *addr)
+{
+  AkSlab *slab = (AkSlab *)alloc;
+  AkSlabClass *c;
+
+  if (!addr)
+    return;
+
+  if (akSlabIsLarge(addr)) {
+    ak_free(slab->backing, addr);
+    return;
+  }
+
+  c = &slab->classes[akSlabPageOf(addr)->cls];
+  *(void **)addr = c->free;
+  c->free = addr;
+}
+
+static
+void
+akSlabFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkSlab *slab = (AkSlab *)alloc;
+  AkSlabClass *c;
+  int cls;
+
+  if (!addr)
+    return;
+
+  cls = akSlabClassOf(size * count, align);
+  if (cls < 0) {
+    ak_free_sized_raw(slab->backing, addr, size * count,
+                      akSlabLargeAlign(align), 1);
+    return;
+  }
+
+  ALLOCKIT_ASSERT((unsigned int)cls == akSlabPageOf(addr)->cls);
+
+  c = &slab->classes[cls];
+  *(void **)addr = c->free;
+  c->free = addr;
+}
+
+static
+ALLOCKIT_SIZE_T
+akSlabAllocBatch(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                 ALLOCKIT_SIZE_T count, void **addrs, ALLOCKIT_SIZE_T n)
+{
+  AkSlab *slab = (AkSlab *)alloc;
+  AkSlabClass *c;
+  void *block;
+  ALLOCKIT_SIZE_T i;
+  int cls;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  cls = akSlabClassOf(size * count, align);
+  if (cls < 0)
+    return ak_alloc_batch_raw(slab->backing, size * count,
+                              akSlabLargeAlign(align), 1, addrs, n);
+
+  c = &slab->classes[cls];
+  block = c->free;
+  for (i = 0; i < n && block; i++) {
+    addrs[i] = block;
+    block = *(void **)block;
+  }
+  c->free = block;
+
+  for (; i < n; i++) {
+    addrs[i] = akSlabRefill(slab, (unsigned int)cls);
+    if (!addrs[i])
+      break;
+  }
+
+  return i;
+}
+
+static
+void
+akSlabFreeBatch(AkAlloc *alloc, void **addrs, ALLOCKIT_SIZE_T n,
+                ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                ALLOCKIT_SIZE_T count)
+{
+  AkSlab *slab = (AkSlab *)alloc;
+  AkSlabClass *c;
+  void *head;
+  ALLOCKIT_SIZE_T i;
+  int cls;
+
+  cls = akSlabClassOf(size * count, align);
+  if (cls < 0) {
+    ak_free_batch_raw(slab->backing, addrs, n, size * count,
+                      akSlabLargeAlign(align), 1);
+    return;
+  }
+
+  c = &slab->classes[cls];
+  head = c->free;
+  for (i = 0; i < n; i++) {
+    if (!addrs[i])
+      continue;
+    ALLOCKIT_ASSERT((unsigned int)cls == akSlabPageOf(addrs[i])->cls);
+    *(void **)addrs[i] = head;
+    head = addrs[i];
+  }
+  c->free = head;
+}
+
+void
+ak_slab_init(AkSlab *slab, AkAlloc *backing)
+{
+  unsigned int i;
+
+  slab->alloc.alloc = akSlabAlloc;
+  slab->alloc.resize = akSlabResize;
+  slab->alloc.free = akSlabFree;
+  slab->alloc.free_sized = akSlabFreeSized;
+  slab->alloc.remap = NULL;
+  slab->alloc.alloc_ex = akSlabAllocEx;
+  slab->alloc.alloc_batch = akSlabAllocBatch;
+  slab->alloc.free_batch = akSlabFreeBatch;
+  slab->backing = backing;
+  slab->pages = NULL;
+
+  for (i = 0; i < ALLOCKIT_SLAB_CLASSES; i++) {
+    slab->classes[i].free = NULL;
+    slab->classes[i].bump = NULL;
+    slab->classes[i].end = NULL;
+  }
+}
+
+void
+ak_slab_deinit(AkSlab *slab)
+{
+  AkSlabPage *page = slab->pages;
+
+  while (page) {
+    AkSlabPage *next = page->next;
+    ak_free(slab->backing, page);
+    page = next;
+  }
+
+  ak_slab_init(slab, slab->backing);
+}
+
+#endif  /* !ALLOCKIT_SLAB_H_IMPL */
+#endif  /* ALLOCKIT_SLAB_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,148 @@
+/* ak_stack.h - stack allocator with marks for AllocKit
+
+   FLAGS
+     ak_stack.h has no implementation of its own. It is a set of names
+     for the arena in ak_arena.h, so ALLOCKIT_ARENA_IMPLEMENTATION
+     must be defined in exactly one source file instead, and
+     ALLOCKIT_ARENA_CHUNK_SIZE applies.
+
+   USAGE
+
+       A stack allocator bumps a pointer through chunks obtained from
+       a backing allocator, and lets any number of nested scopes be
+       released at once. `ak_stack_mark` captures the top of the
+       stack, and `ak_stack_rollback` releases everything allocated
+       since, in O(1). It is the arena from ak_arena.h, under names
+       for code that only ever uses it as a stack.
+
+         #include "allockit.h"
+         #include "ak_stack.h"
+
+         AkStack stack = {0};
+         ak_stack_init(&stack, backing, 0);
+
+         Value
+         eval(AkStack *stack, Node *node)
+         {
+           AkStackMark mark = ak_stack_mark(stack);
+           Value *args = ak_alloc(&stack->alloc, Value, node->argc);
+           Value result;
+           ...
+           for (i = 0; i < node->argc; i++)
+             args[i] = eval(stack, node->args[i]);
+           result = apply(node, args);
+
+           ak_stack_rollback(stack, mark);
+           return result;
+         }
+
+       A mark is only valid until the stack is rolled back past it.
+       Rolling back keeps the chunks that were in use, and reuses them
+       for later allocations, so a stack that is repeatedly rolled
+       back stops touching the backing allocator once it has grown to
+       fit its deepest use.
+
+       `resize`, `free` and `ak_free_sized` behave as for the arena:
+       they only reclaim space at the top of the stack.
+
+       `ak_stack_deinit` returns all chunks to the backing allocator.
+
+         ak_stack_deinit(&stack);
+
+       The stack allocator is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_STACK_H_DEFS
+#define ALLOCKIT_STACK_H_DEFS
+
+#include "allockit.h"
+#include "ak_arena.h"
+
+typedef AkArena AkStack;
+typedef AkArenaMark AkStackMark;
+
+static inline
+void
+ak_stack_init(AkStack *stack, AkAlloc *backing, ALLOCKIT_SIZE_T chunk_size)
+{
+  ak_arena_init(stack, backing, chunk_size);
+}
+
+static inline
+void
+ak_stack_deinit(AkStack *stack)
+{
+  ak_arena_deinit(stack);
+}
+
+static inline
+AkStackMark
+ak_stack_mark(AkStack *stack)
+{
+  return ak_arena_mark(stack);
+}
+
+static inline
+void
+ak_stack_rollback(AkStack *stack, AkStackMark mark)
+{
+  ak_arena_rollback(stack, mark);
+}
+
+#endif  /* !ALLOCKIT_STACK_H_DEFS */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,557 @@
+/* ak_stats.h - statistics-collecting wrapper for AllocKit
+
+   FLAGS
+     ALLOCKIT_STATS_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_stats.h to emit the implementation. The implementation
+       requires POSIX threads and C11 atomics.
+
+     ALLOCKIT_STATS_BATCH (default: 65536)
+       Number of bytes a thread's live byte count may drift by before
+       it is added to the shared total. Larger values make the count
+       cheaper to keep, and the peak less precise.
+
+   USAGE
+
+       The stats wrapper forwards every call to an inner allocator,
+       counting the calls made and the bytes in use along the way, so
+       that allocator-heavy code can be found without a profiler.
+
+         #include "allockit.h"
+         #include "ak_stats.h"
+
+         AkStats stats = {0};
+         if (!ak_stats_init(&stats, backing))
+           return -1;
+
+         run_subsystem(&stats.alloc);
+
+         AkStatsSnapshot snap;
+         ak_stats_read(&stats, &snap);
+         printf("%llu allocs, %llu bytes live, %llu peak\n",
+                (unsigned long long)snap.allocs,
+                (unsigned long long)snap.live_bytes,
+                (unsigned long long)snap.peak_bytes);
+
+       `ak_stats_read` fills in:
+
+         allocs, frees, resizes
+           Number of successful calls of each kind, including those
+           made through `ak_free_sized` and the other entry points.
+         failed_allocs, failed_resizes
+           Number of calls that returned NULL or 0.
+         live_bytes, peak_bytes
+           Bytes requested and not yet freed, now and at most.
+
+       Each thread keeps its own counters, so counting doesn't make
+       threads contend with each other. `ak_stats_read` adds up every
+       thread's counters, including those of threads that have exited,
+       so while other threads are allocating, the result is only
+       approximate. Live bytes are added to a shared total once a
+       thread's count has drifted by ALLOCKIT_STATS_BATCH bytes, and
+       the peak is taken from that total, so it may be off by up to
+       that much per thread.
+
+       To count bytes on `free`, each allocation records its size in a
+       small header in front of the returned address. The header takes
+       two words, rounded up to the allocation's alignment.
+
+       The wrapper is as thread-safe as the inner allocator, which
+       must be thread-safe if the wrapper is used from several
+       threads. `ak_stats_deinit` releases the counters; the inner
+       allocator is not touched.
+
+         ak_stats_deinit(&stats);
+
+ */
+
+#ifndef ALLOCKIT_STATS_H_DEFS
+#define ALLOCKIT_STATS_H_DEFS
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_STATS_BATCH
+#  define ALLOCKIT_STATS_BATCH 65536
+#endif  /* !ALLOCKIT_STATS_BATCH */
+
+typedef struct AkStatsSnapshot {
+  uint64_t allocs;
+  uint64_t frees;
+  uint64_t resizes;
+  uint64_t failed_allocs;
+  uint64_t failed_resizes;
+  uint64_t live_bytes;
+  uint64_t peak_bytes;
+} AkStatsSnapshot;
+
+typedef struct AkStatsLocal {
+  struct AkStats *stats;
+  struct AkStatsLocal *prev;
+  struct AkStatsLocal *next;
+  _Atomic uint64_t allocs;
+  _Atomic uint64_t frees;
+  _Atomic uint64_t resizes;
+  _Atomic uint64_t failed_allocs;
+  _Atomic uint64_t failed_resizes;
+  _Atomic int64_t pending;
+} AkStatsLocal;
+
+typedef struct AkStats {
+  AkAlloc alloc;
+  AkAlloc *inner;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  AkStatsLocal *locals;
+  AkStatsSnapshot retired;
+  _Atomic int64_t live;
+  _Atomic int64_t peak;
+} AkStats;
+
+int ak_stats_init(AkStats *stats, AkAlloc *inner);
+void ak_stats_deinit(AkStats *stats);
+
+void ak_stats_read(AkStats *stats, AkStatsSnapshot *snap);
+
+#endif  /* !ALLOCKIT_STATS_H_DEFS */
+
+#ifdef ALLOCKIT_STATS_IMPLEMENTATION
+#ifndef ALLOCKIT_STATS_H_IMPL
+#define ALLOCKIT_STATS_H_IMPL
+
+typedef struct AkStatsHeader {
+  unsigned char *base;
+  ALLOCKIT_SIZE_T bytes;
+} AkStatsHeader;
+
+static
+AkStatsHeader *
+akStatsHeaderOf(void *addr)
+{
+  return (AkStatsHeader *)addr - 1;
+}
+
+/* Alignment that the inner allocator is asked for, so that the header
+   in front of the returned address is aligned too. */
+static
+ALLOCKIT_SIZE_T
+akStatsAlign(ALLOCKIT_SIZE_T align)
+{
+  if (align < ALLOCKIT_ALIGNOF(AkStatsHeader))
+    return ALLOCKIT_ALIGNOF(AkStatsHeader);
+  return align;
+}
+
+/* Offset of the returned address from the start of the inner
+   allocation. */
+static
+ALLOCKIT_SIZE_T
+akStatsOffset(ALLOCKIT_SIZE_T align)
+{
+  return (sizeof(AkStatsHeader) + align - 1) & ~(align - 1);
+}
+
+/* Counters are only written by their own thread, so a plain load and
+   store is enough, and `ak_stats_read` sees either value. */
+static
+void
+akStatsBump(_Atomic uint64_t *counter)
+{
+  atomic_store_explicit(counter,
+                        atomic_load_explicit(counter,
+                                             memory_order_relaxed) + 1,
+                        memory_order_relaxed);
+}
+
+static
+void
+akStatsRaisePeak(AkStats *stats, int64_t live)
+{
+  int64_t peak = atomic_load_explicit(&stats->peak, memory_order_relaxed);
+
+  while (live > peak
+         && !atomic_compare_exchange_weak_explicit(&stats->peak, &peak,
+                                                   live,
+                                                   memory_order_relaxed,
+                                                   memory_order_relaxed))
+    ;
+}
+
+static
+void
+akStatsFlush(AkStats *stats, AkStatsLocal *local)
+{
+  int64_t pending = atomic_load_explicit(&local->pending,
+                                         memory_order_relaxed);
+
+  atomic_store_explicit(&local->pending, 0, memory_order_relaxed);
+  akStatsRaisePeak(stats, atomic_fetch_add_explicit(&stats->live, pending,
+                                                    memory_order_relaxed)
+                          + pending);
+}
+
+static
+void
+akStatsAddLive(AkStats *stats, AkStatsLocal *local, int64_t delta)
+{
+  int64_t pending = atomic_load_explicit(&local->pending,
+                                         memory_order_relaxed) + delta;
+
+  atomic_store_explicit(&local->pending, pending, memory_order_relaxed);
+  if (pending >= ALLOCKIT_STATS_BATCH || pending <= -ALLOCKIT_STATS_BATCH)
+    akStatsFlush(stats, local);
+}
+
+static
+void
+akStatsUnlink(AkStats *stats, AkStatsLocal *local)
+{
+  if (local->prev)
+    local->prev->next = local->next;
+  else
+    stats->locals = local->next;
+  if (local->next)
+    local->next->prev = local->prev;
+}
+
+/* Adds a thread's counters to the totals of exited threads. Must be
+   called with the lock held. */
+static
+void
+akStatsRetire(AkStats *stats, AkStatsLocal *local)
+{
+  stats->retired.allocs += atomic_load(&local->allocs);
+  stats->retired.frees += atomic_load(&local->frees);
+  stats->retired.resizes += atomic_load(&local->resizes);
+  stats->retired.failed_allocs += atomic_load(&local->failed_allocs);
+  stats->retired.failed_resizes += atomic_load(&local->failed_resizes);
+  akStatsFlush(stats, local);
+}
+
+static
+void
+akStatsExit(void *data)
+{
+  AkStatsLocal *local = data;
+  AkStats *stats = local->stats;
+
+  pthread_mutex_lock(&stats->lock);
+  akStatsRetire(stats, local);
+  akStatsUnlink(stats, local);
+  pthread_mutex_unlock(&stats->lock);
+
+  ak_free_sized(stats->inner, local, AkStatsLocal, 1);
+}
+
+static
+AkStatsLocal *
+akStatsLocal(AkStats *stats)
+{
+  AkStatsLocal *local = pthread_getspecific(stats->key);
+
+  if (local)
+    return local;
+
+  local = ak_alloc(stats->inner, AkStatsLocal, 1);
+  if (!local)
+    return NULL;
+
+  local->stats = stats;
+  atomic_init(&local->allocs, 0);
+  atomic_init(&local->frees, 0);
+  atomic_init(&local->resizes, 0);
+  atomic_init(&local->failed_allocs, 0);
+  atomic_init(&local->failed_resizes, 0);
+  atomic_init(&local->pending, 0);
+
+  if (pthread_setspecific(stats->key, local) != 0) {
+    ak_free_sized(stats->inner, local, AkStatsLocal, 1);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&stats->lock);
+  local->prev = NULL;
+  local->next = stats->locals;
+  if (stats->locals)
+    stats->locals->prev = local;
+  stats->locals = local;
+  pthread_mutex_unlock(&stats->lock);
+
+  return local;
+}
+
+static
+void *
+akStatsAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+               ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkStats *stats = (AkStats *)alloc;
+  AkStatsLocal *local = akStatsLocal(stats);
+  AkStatsHeader *header;
+  ALLOCKIT_SIZE_T offset, got;
+  unsigned char *base = NULL;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (!local)
+    return NULL;
+
+  align = akStatsAlign(align);
+  offset = akStatsOffset(align);
+  if ((!count || size <= (ALLOCKIT_SIZE_T)-1 / count)
+      && size * count <= (ALLOCKIT_SIZE_T)-1 - offset)
+    base = ak_alloc_ex_raw(stats->inner, offset + size * count, align, 1,
+                           &got);
+
+  if (!base) {
+    akStatsBump(&local->failed_allocs);
+    return NULL;
+  }
+
+  header = akStatsHeaderOf(base + offset);
+  header->base = base;
+  header->bytes = size * count;
+  akStatsBump(&local->allocs);
+  akStatsAddLive(stats, local, (int64_t)header->bytes);
+
+  *usable = got - offset;
+  return base + offset;
+}
+
+static
+void *
+akStatsAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+             ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akStatsAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akStatsResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+              ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkStats *stats = (AkStats *)alloc;
+  AkStatsLocal *local = akStatsLocal(stats);
+  AkStatsHeader *header;
+  ALLOCKIT_SIZE_T offset;
+  int ok = 0;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!local)
+    return 0;
+
+  align = akStatsAlign(align);
+  offset = akStatsOffset(align);
+  if (addr && (!count || size <= (ALLOCKIT_SIZE_T)-1 / count)
+      && size * count <= (ALLOCKIT_SIZE_T)-1 - offset)
+    ok = ak_resize_raw(stats->inner, akStatsHeaderOf(addr)->base,
+                       offset + size * count, align, 1);
+
+  if (!ok) {
+    akStatsBump(&local->failed_resizes);
+    return 0;
+  }
+
+  header = akStatsHeaderOf(addr);
+  akStatsBump(&local->resizes);
+  akStatsAddLive(stats, local,
+                 (int64_t)(size * count) - (int64_t)header->bytes);
+  header->bytes = size * count;
+  return 1;
+}
+
+static
+void
+akStatsFree(AkAlloc *alloc, void *addr)
+{
+  AkStats *stats = (AkStats *)alloc;
+  AkStatsLocal *local;
+  AkStatsHeader *header;
+
+  if (!addr)
+    return;
+
+  header = akStatsHeaderOf(addr);
+  local = akStatsLocal(stats);
+  if (local) {
+    akStatsBump(&local->frees);
+    akStatsAddLive(stats, local, -(int64_t)header->bytes);
+  }
+
+  ak_free(stats->inner, header->base);
+}
+
+static
+void
+akStatsFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                 ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkStats *stats = (AkStats *)alloc;
+  AkStatsLocal *local;
+  AkStatsHeader *header;
+  ALLOCKIT_SIZE_T offset;
+
+  if (!addr)
+    return;
+
+  header = akStatsHeaderOf(addr);
+  local = akStatsLocal(stats);
+  if (local) {
+    akStatsBump(&local->frees);
+    akStatsAddLive(stats, local, -(int64_t)header->bytes);
+  }
+
+  align = akStatsAlign(align);
+  offset = akStatsOffset(align);
+  ak_free_sized_raw(stats->inner, header->base, offset + size * count,
+                    align, 1);
+}
+
+int
+ak_stats_init(AkStats *stats, AkAlloc *inner)
+{
+  stats->alloc.alloc = akStatsAlloc;
+  stats->alloc.resize = akStatsResize;
+  stats->alloc.free = akStatsFree;
+  stats->alloc.free_sized = akStatsFreeSized;
+  stats->alloc.remap = NULL;
+  stats->alloc.alloc_ex = akStatsAllocEx;
+  stats->alloc.alloc_batch = NULL;
+  stats->alloc.free_batch = NULL;
+  stats->inner = inner;
+  stats->locals = NULL;
+  stats->retired.allocs = 0;
+  stats->retired.frees = 0;
+  stats->retired.resizes = 0;
+  stats->retired.failed_allocs = 0;
+  stats->retired.failed_resizes = 0;
+  stats->retired.live_bytes = 0;
+  stats->retired.peak_bytes = 0;
+  atomic_init(&stats->live, 0);
+  atomic_init(&stats->peak, 0);
+
+  if (pthread_mutex_init(&stats->lock, NULL) != 0)
+    return 0;
+  if (pthread_key_create(&stats->key, akStatsExit) != 0) {
+    pthread_mutex_destroy(&stats->lock);
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+ak_stats_deinit(AkStats *stats)
+{
+  AkStatsLocal *local = stats->locals;
+
+  pthread_key_delete(stats->key);
+
+  while (local) {
+    AkStatsLocal *next = local->next;
+    ak_free_sized(stats->inner, local, AkStatsLocal, 1);
+    local = next;
+  }
+
+  stats->locals = NULL;
+  pthread_mutex_destroy(&stats->lock);
+}
+
+void
+ak_stats_read(AkStats *stats, AkStatsSnapshot *snap)
+{
+  AkStatsLocal *local;
+  int64_t live;
+
+  pthread_mutex_lock(&stats->lock);
+
+  *snap = stats->retired;
+  live = atomic_load_explicit(&stats->live, memory_order_relaxed);
+  for (local = stats->locals; local; local = local->next) {
+    snap->allocs += atomic_load_explicit(&local->allocs,
+                                         memory_order_relaxed);
+    snap->frees += atomic_load_explicit(&local->frees,
+                                        memory_order_relaxed);
+    snap->resizes += atomic_load_explicit(&local->resizes,
+                                          memory_order_relaxed);
+    snap->failed_allocs += atomic_load_explicit(&local->failed_allocs,
+                                                memory_order_relaxed);
+    snap->failed_resizes += atomic_load_explicit(&local->failed_resizes,
+                                                 memory_order_relaxed);
+    live += atomic_load_explicit(&local->pending, memory_order_relaxed);
+  }
+
+  pthread_mutex_unlock(&stats->lock);
+
+  if (live < 0)
+    live = 0;
+  akStatsRaisePeak(stats, live);
+  snap->live_bytes = (uint64_t)live;
+  snap->peak_bytes = (uint64_t)atomic_load_explicit(&stats->peak,
+                                                    memory_order_relaxed);
+}
+
+#endif  /* !ALLOCKIT_STATS_H_IMPL */
+#endif  /* ALLOCKIT_STATS_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,512 @@
+/* ak_thread_cache.h - per-thread caching front-end for AllocKit
+
+   FLAGS
+     ALLOCKIT_THREAD_CACHE_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_thread_cache.h to emit the implementation. The
+       implementation requires POSIX threads.
+
+     ALLOCKIT_THREAD_CACHE_MAGAZINE (default: 64)
+       Number of blocks each thread may hold per size class.
+
+   USAGE
+
+       A thread cache sits in front of a thread-safe backing
+       allocator, usually one that takes a lock. Small blocks freed
+       by a thread are kept in a per-thread "magazine" for their size
+       class, and later allocations of that class by the same thread
+       are served from it without touching the backing allocator.
+       The backing allocator is only used when a magazine runs empty,
+       to refill half of it with `ak_alloc_batch`, or fills up, to
+       flush half of it with `ak_free_batch`.
+
+         #include "allockit.h"
+         #include "ak_thread_cache.h"
+
+         AkThreadCache cache = {0};
+         if (!ak_thread_cache_init(&cache, locked_backing))
+           return -1;
+
+         do_work_on_many_threads(&cache.alloc);
+
+       Only allocations of up to ALLOCKIT_THREAD_CACHE_MAX_SIZE (1024)
+       bytes, aligned to at most ALLOCKIT_THREAD_CACHE_ALIGN (16)
+       bytes, are cached. They are rounded up to a size class before
+       being requested from the backing allocator, and `ak_alloc_ex`
+       reports the size of the class as usable. Everything else is
+       passed through to the backing allocator.
+
+       Every block is preceded by a 16-byte header that records its
+       size class, so that both `free` and `ak_free_sized` return
+       cached blocks to their magazine, and `resize` succeeds for a
+       cached block whenever the new size still fits in its class.
+       Blocks passed through with an alignment above 16 bytes take
+       `align` bytes of header instead.
+
+       A thread's magazines are flushed to the backing allocator when
+       the thread exits. `ak_thread_cache_deinit` flushes those of
+       every remaining thread, so no thread may use the cache while
+       or after it is called.
+
+         ak_thread_cache_deinit(&cache);
+
+       The thread cache is thread-safe as long as the backing
+       allocator is.
+
+ */
+
+#ifndef ALLOCKIT_THREAD_CACHE_H_DEFS
+#define ALLOCKIT_THREAD_CACHE_H_DEFS
+
+#include <pthread.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_THREAD_CACHE_MAGAZINE
+#  define ALLOCKIT_THREAD_CACHE_MAGAZINE 64
+#endif  /* !ALLOCKIT_THREAD_CACHE_MAGAZINE */
+
+#define ALLOCKIT_THREAD_CACHE_CLASSES 20
+#define ALLOCKIT_THREAD_CACHE_MAX_SIZE 1024
+#define ALLOCKIT_THREAD_CACHE_ALIGN 16
+
+typedef struct AkThreadCacheMagazine {
+  ALLOCKIT_SIZE_T count;
+  void *blocks[ALLOCKIT_THREAD_CACHE_MAGAZINE];
+} AkThreadCacheMagazine;
+
+typedef struct AkThreadCacheLocal {
+  struct AkThreadCache *cache;
+  struct AkThreadCacheLocal *prev;
+  struct AkThreadCacheLocal *next;
+  AkThreadCacheMagazine magazines[ALLOCKIT_THREAD_CACHE_CLASSES];
+} AkThreadCacheLocal;
+
+typedef struct AkThreadCache {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  AkThreadCacheLocal *locals;
+} AkThreadCache;
+
+int ak_thread_cache_init(AkThreadCache *cache, AkAlloc *backing);
+void ak_thread_cache_deinit(AkThreadCache *cache);
+
+#endif  /* !ALLOCKIT_THREAD_CACHE_H_DEFS */
+
+#ifdef ALLOCKIT_THREAD_CACHE_IMPLEMENTATION
+#ifndef ALLOCKIT_THREAD_CACHE_H_IMPL
+#define ALLOCKIT_THREAD_CACHE_H_IMPL
+
+#include <stdint.h>
+
+static const unsigned short
+akThreadCacheClassSize[ALLOCKIT_THREAD_CACHE_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024
+};
+
+/* Indexed by (bytes + 15) >> 4. */
+static const unsigned char akThreadCacheClassIndex[] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11,
+  11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+  15, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17,
+  17, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19,
+  19
+};
+
+/* Returns the size class for an allocation, or -1 if it is passed
+   through to the backing allocator. */
+static
+int
+akThreadCacheClassOf(ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                     ALLOCKIT_SIZE_T count)
+{
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return -1;
+  if (size * count > ALLOCKIT_THREAD_CACHE_MAX_SIZE
+      || align > ALLOCKIT_THREAD_CACHE_ALIGN)
+    return -1;
+
+  return akThreadCacheClassIndex[(size * count + 15) >> 4];
+}
+
+/* Precedes every block handed out, at ALLOCKIT_THREAD_CACHE_ALIGN
+   bytes before it. `cls` is the size class of a cached block, or
+   ALLOCKIT_THREAD_CACHE_CLASSES for a block passed through to the
+   backing allocator, whose allocation starts `offset` bytes before
+   the block. Magazines hold the start of each cached allocation,
+   where its header is. */
+typedef struct AkThreadCacheHeader {
+  ALLOCKIT_SIZE_T cls;
+  ALLOCKIT_SIZE_T offset;
+} AkThreadCacheHeader;
+
+static
+AkThreadCacheHeader *
+akThreadCacheHeaderOf(void *addr)
+{
+  return (AkThreadCacheHeader *)((unsigned char *)addr
+                                 - ALLOCKIT_THREAD_CACHE_ALIGN);
+}
+
+static
+void
+akThreadCacheFlush(AkThreadCache *cache, AkThreadCacheLocal *local)
+{
+  unsigned int i;
+
+  for (i = 0; i < ALLOCKIT_THREAD_CACHE_CLASSES; i++) {
+    AkThreadCacheMagazine *mag = &local->magazines[i];
+
+    ak_free_batch_raw(cache->backing, mag->blocks, mag->count,
+                      akThreadCacheClassSize[i]
+                      + ALLOCKIT_THREAD_CACHE_ALIGN,
+                      ALLOCKIT_THREAD_CACHE_ALIGN, 1);
+    mag->count = 0;
+  }
+}
+
+static
+void
+akThreadCacheUnlink(AkThreadCache *cache, AkThreadCacheLocal *local)
+{
+  if (local->prev)
+    local->prev->next = local->next;
+  else
+    cache->locals = local->next;
+  if (local->next)
+    local->next->prev = local->prev;
+}
+
+static
+void
+akThreadCacheExit(void *data)
+{
+  AkThreadCacheLocal *local = data;
+  AkThreadCache *cache = local->cache;
+
+  akThreadCacheFlush(cache, local);
+
+  pthread_mutex_lock(&cache->lock);
+  akThreadCacheUnlink(cache, local);
+  pthread_mutex_unlock(&cache->lock);
+
+  ak_free_sized(cache->backing, local, AkThreadCacheLocal, 1);
+}
+
+static
+AkThreadCacheLocal *
+akThreadCacheLocal(AkThreadCache *cache)
+{
+  AkThreadCacheLocal *local = pthread_getspecific(cache->key);
+  unsigned int i;
+
+  if (local)
+    return local;
+
+  local = ak_alloc(cache->backing, AkThreadCacheLocal, 1);
+  if (!local)
+    return NULL;
+
+  local->cache = cache;
+  for (i = 0; i < ALLOCKIT_THREAD_CACHE_CLASSES; i++)
+    local->magazines[i].count = 0;
+
+  if (pthread_setspecific(cache->key, local) != 0) {
+    ak_free_sized(cache->backing, local, AkThreadCacheLocal, 1);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cache->lock);
+  local->prev = NULL;
+  local->next = cache->locals;
+  if (cache->locals)
+    cache->locals->prev = local;
+  cache->locals = local;
+  pthread_mutex_unlock(&cache->lock);
+
+  return local;
+}
+
+static
+void *
+akThreadCacheAllocLarge(AkThreadCache *cache, ALLOCKIT_SIZE_T size,
+                        ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                        ALLOCKIT_SIZE_T *usable)
+{
+  ALLOCKIT_SIZE_T offset = align > ALLOCKIT_THREAD_CACHE_ALIGN
+                           ? align : ALLOCKIT_THREAD_CACHE_ALIGN;
+  AkThreadCacheHeader *header;
+  unsigned char *base;
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - offset)
+    return NULL;
+
+  base = ak_alloc_ex_raw(cache->backing, size * count + offset, offset, 1,
+                         usable);
+  if (!base)
+    return NULL;
+
+  header = akThreadCacheHeaderOf(base + offset);
+  header->cls = ALLOCKIT_THREAD_CACHE_CLASSES;
+  header->offset = offset;
+  *usable -= offset;
+  return base + offset;
+}
+
+static
+void *
+akThreadCacheAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                     ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                     ALLOCKIT_SIZE_T *usable)
+{
+  AkThreadCache *cache = (AkThreadCache *)alloc;
+  AkThreadCacheLocal *local;
+  AkThreadCacheMagazine *mag;
+  int cls = akThreadCacheClassOf(size, align, count);
+  ALLOCKIT_SIZE_T i;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (cls < 0)
+    return akThreadCacheAllocLarge(cache, size, align, count, usable);
+
+  local = akThreadCacheLocal(cache);
+  if (!local)
+    return NULL;
+
+  mag = &local->magazines[cls];
+  if (!mag->count) {
+    mag->count = ak_alloc_batch_raw(cache->backing,
+                                    akThreadCacheClassSize[cls]
+                                    + ALLOCKIT_THREAD_CACHE_ALIGN,
+                                    ALLOCKIT_THREAD_CACHE_ALIGN, 1,
+                                    mag->blocks,
+                                    ALLOCKIT_THREAD_CACHE_MAGAZINE / 2);
+    if (!mag->count)
+      return NULL;
+
+    for (i = 0; i < mag->count; i++) {
+      AkThreadCacheHeader *header = mag->blocks[i];
+
+      header->cls = (ALLOCKIT_SIZE_T)cls;
+      header->offset = ALLOCKIT_THREAD_CACHE_ALIGN;
+    }
+  }
+
+  *usable = akThreadCacheClassSize[cls];
+  return (unsigned char *)mag->blocks[--mag->count]
+         + ALLOCKIT_THREAD_CACHE_ALIGN;
+}
+
+static
+void *
+akThreadCacheAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akThreadCacheAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akThreadCacheResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkThreadCache *cache = (AkThreadCache *)alloc;
+  AkThreadCacheHeader *header;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  /* Cached blocks keep their class, so that they can be flushed back
+     with its size. */
+  header = akThreadCacheHeaderOf(addr);
+  if (header->cls < ALLOCKIT_THREAD_CACHE_CLASSES)
+    return size * count <= akThreadCacheClassSize[header->cls];
+
+  if (size * count > (ALLOCKIT_SIZE_T)-1 - header->offset)
+    return 0;
+  return ak_resize_raw(cache->backing,
+                       (unsigned char *)addr - header->offset,
+                       size * count + header->offset, header->offset, 1);
+}
+
+/* Returns the cached allocation starting at `base`, of size class
+   `cls`, to the calling thread's magazine. */
+static
+void
+akThreadCachePut(AkThreadCache *cache, void *base, ALLOCKIT_SIZE_T cls)
+{
+  AkThreadCacheLocal *local = akThreadCacheLocal(cache);
+  AkThreadCacheMagazine *mag;
+
+  if (!local) {
+    ak_free_sized_raw(cache->backing, base,
+                      akThreadCacheClassSize[cls]
+                      + ALLOCKIT_THREAD_CACHE_ALIGN,
+                      ALLOCKIT_THREAD_CACHE_ALIGN, 1);
+    return;
+  }
+
+  mag = &local->magazines[cls];
+  if (mag->count == ALLOCKIT_THREAD_CACHE_MAGAZINE) {
+    mag->count -= ALLOCKIT_THREAD_CACHE_MAGAZINE / 2;
+    ak_free_batch_raw(cache->backing, mag->blocks + mag->count,
+                      ALLOCKIT_THREAD_CACHE_MAGAZINE / 2,
+                      akThreadCacheClassSize[cls]
+                      + ALLOCKIT_THREAD_CACHE_ALIGN,
+                      ALLOCKIT_THREAD_CACHE_ALIGN, 1);
+  }
+
+  mag->blocks[mag->count++] = base;
+}
+
+static
+void
+akThreadCacheFree(AkAlloc *alloc, void *addr)
+{
+  AkThreadCache *cache = (AkThreadCache *)alloc;
+  AkThreadCacheHeader *header;
+
+  if (!addr)
+    return;
+
+  header = akThreadCacheHeaderOf(addr);
+  if (header->cls < ALLOCKIT_THREAD_CACHE_CLASSES)
+    akThreadCachePut(cache, header, header->cls);
+  else
+    ak_free(cache->backing, (unsigned char *)addr - header->offset);
+}
+
+static
+void
+akThreadCacheFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                       ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkThreadCache *cache = (AkThreadCache *)alloc;
+  AkThreadCacheHeader *header;
+
+  (void)align;
+
+  if (!addr)
+    return;
+
+  header = akThreadCacheHeaderOf(addr);
+  if (header->cls < ALLOCKIT_THREAD_CACHE_CLASSES)
+    akThreadCachePut(cache, header, header->cls);
+  else
+    ak_free_sized_raw(cache->backing,
+                      (unsigned char *)addr - header->offset,
+                      size * count + header->offset, header->offset, 1);
+}
+
+int
+ak_thread_cache_init(AkThreadCache *cache, AkAlloc *backing)
+{
+  cache->alloc.alloc = akThreadCacheAlloc;
+  cache->alloc.resize = akThreadCacheResize;
+  cache->alloc.free = akThreadCacheFree;
+  cache->alloc.free_sized = akThreadCacheFreeSized;
+  cache->alloc.remap = NULL;
+  cache->alloc.alloc_ex = akThreadCacheAllocEx;
+  cache->alloc.alloc_batch = NULL;
+  cache->alloc.free_batch = NULL;
+  cache->backing = backing;
+  cache->locals = NULL;
+
+  if (pthread_mutex_init(&cache->lock, NULL) != 0)
+    return 0;
+  if (pthread_key_create(&cache->key, akThreadCacheExit) != 0) {
+    pthread_mutex_destroy(&cache->lock);
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+ak_thread_cache_deinit(AkThreadCache *cache)
+{
+  AkThreadCacheLocal *local = cache->locals;
+
+  pthread_key_delete(cache->key);
+
+  while (local) {
+    AkThreadCacheLocal *next = local->next;
+    akThreadCacheFlush(cache, local);
+    ak_free_sized(cache->backing, local, AkThreadCacheLocal, 1);
+    local = next;
+  }
+
+  cache->locals = NULL;
+  pthread_mutex_destroy(&cache->lock);
+}
+
+#endif  /* !ALLOCKIT_THREAD_CACHE_H_IMPL */
+#endif  /* ALLOCKIT_THREAD_CACHE_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,600 @@
+/* ak_thread_heap.h - lock-free per-thread heaps for AllocKit
+
+   FLAGS
+     ALLOCKIT_THREAD_HEAP_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_thread_heap.h to emit the implementation. The
+       implementation requires POSIX threads and C11 atomics.
+
+     ALLOCKIT_THREAD_HEAP_PAGE_SIZE (default: 65536)
+       Size in bytes of each page requested from the backing
+       allocator. Must be a power of two larger than 4096. Pages are
+       requested aligned to their own size.
+
+   USAGE
+
+       The thread heap is a thread-safe small-object allocator that
+       takes no locks on its fast paths. Every thread gets a heap of
+       its own, made of pages that each serve a single size class,
+       using the same size classes as ak_slab.h.
+
+         #include "allockit.h"
+         #include "ak_thread_heap.h"
+
+         AkThreadHeap heap = {0};
+         if (!ak_thread_heap_init(&heap, &ak_page_allocator))
+           return -1;
+
+         start_pipeline(&heap.alloc);
+
+       A page belongs to the thread that allocated it. When that
+       thread frees a block, the block is pushed on the page's local
+       free list with no synchronization at all. When any other thread
+       frees a block, it is pushed on the page's remote free list
+       with a single compare-and-swap. The owning thread takes the
+       whole remote free list over with one atomic exchange, and only
+       once its local free list for that page has run dry. This keeps
+       producer/consumer workloads, where blocks are allocated on one
+       thread and freed on another, from contending on a lock.
+
+       When a thread exits, its pages are abandoned to the heap, and
+       are adopted again by the next thread that needs a page of the
+       same size class. Blocks may be freed into abandoned pages from
+       any thread in the meantime.
+
+       Requests larger than ALLOCKIT_THREAD_HEAP_MAX_SIZE (2048)
+       bytes, or aligned to more than ALLOCKIT_THREAD_HEAP_MAX_ALIGN
+       (64) bytes, are passed through to the backing allocator,
+       aligned to ALLOCKIT_THREAD_HEAP_PAGE_SIZE. The backing
+       allocator must be thread-safe.
+
+       `resize` succeeds for a small allocation whenever the new size
+       maps to the same size class, and is forwarded to the backing
+       allocator for large allocations that stay large.
+
+       Pages are only returned to the backing allocator by
+       `ak_thread_heap_deinit`, which no thread may be using the heap
+       during or after.
+
+         ak_thread_heap_deinit(&heap);
+
+ */
+
+#ifndef ALLOCKIT_THREAD_HEAP_H_DEFS
+#define ALLOCKIT_THREAD_HEAP_H_DEFS
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_THREAD_HEAP_PAGE_SIZE
+#  define ALLOCKIT_THREAD_HEAP_PAGE_SIZE 65536
+#endif  /* !ALLOCKIT_THREAD_HEAP_PAGE_SIZE */
+
+#define ALLOCKIT_THREAD_HEAP_CLASSES 24
+#define ALLOCKIT_THREAD_HEAP_MAX_SIZE 2048
+#define ALLOCKIT_THREAD_HEAP_MAX_ALIGN 64
+
+struct AkThreadHeapLocal;
+
+typedef struct AkThreadHeapPage {
+  _Atomic(struct AkThreadHeapLocal *) owner;
+  _Atomic(void *) remote;
+  void *free;
+  unsigned char *bump;
+  unsigned char *end;
+  struct AkThreadHeapPage *next;
+  struct AkThreadHeapPage *all_next;
+  unsigned int cls;
+} AkThreadHeapPage;
+
+typedef struct AkThreadHeapLocal {
+  struct AkThreadHeap *heap;
+  struct AkThreadHeapLocal *prev;
+  struct AkThreadHeapLocal *next;
+  AkThreadHeapPage *current[ALLOCKIT_THREAD_HEAP_CLASSES];
+  AkThreadHeapPage *pages[ALLOCKIT_THREAD_HEAP_CLASSES];
+} AkThreadHeapLocal;
+
+typedef struct AkThreadHeap {
+  AkAlloc alloc;
+  AkAlloc *backing;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  AkThreadHeapLocal *locals;
+  AkThreadHeapPage *abandoned;
+  AkThreadHeapPage *pages;
+} AkThreadHeap;
+
+int ak_thread_heap_init(AkThreadHeap *heap, AkAlloc *backing);
+void ak_thread_heap_deinit(AkThreadHeap *heap);
+
+#endif  /* !ALLOCKIT_THREAD_HEAP_H_DEFS */
+
+#ifdef ALLOCKIT_THREAD_HEAP_IMPLEMENTATION
+#ifndef ALLOCKIT_THREAD_HEAP_H_IMPL
+#define ALLOCKIT_THREAD_HEAP_H_IMPL
+
+#include <stdint.h>
+
+/* Blocks start this far into a page, which keeps the page header
+   out of the way and every block aligned to the largest power of
+   two dividing its class size, up to ALLOCKIT_THREAD_HEAP_MAX_ALIGN. */
+#define ALLOCKIT_THREAD_HEAP_HEADER_SIZE ALLOCKIT_THREAD_HEAP_MAX_ALIGN
+
+_Static_assert(sizeof(AkThreadHeapPage) <= ALLOCKIT_THREAD_HEAP_HEADER_SIZE,
+               "page header does not fit before the first block");
+
+static const unsigned short
+akThreadHeapClassSize[ALLOCKIT_THREAD_HEAP_CLASSES] = {
+  16, 32, 48, 64, 80, 96, 112, 128,
+  160, 192, 224, 256, 320, 384, 448, 512,
+  640, 768, 896, 1024, 1280, 1536, 1792, 2048
+};
+
+/* Indexed by (bytes + 15) >> 4. */
+static const unsigned char akThreadHeapClassIndex[] = {
+  0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11,
+  11, 12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15,
+  15, 16, 16, 16, 16, 16, 16, 16, 16, 17, 17, 17, 17, 17, 17, 17,
+  17, 18, 18, 18, 18, 18, 18, 18, 18, 19, 19, 19, 19, 19, 19, 19,
+  19, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20, 20,
+  20, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21, 21,
+  21, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22, 22,
+  22, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23, 23,
+  23
+};
+
+/* Returns the size class for an allocation, or -1 if it must be
+   passed through to the backing allocator. */
+static
+int
+akThreadHeapClassOf(ALLOCKIT_SIZE_T bytes, ALLOCKIT_SIZE_T align)
+{
+  unsigned int cls;
+
+  if (bytes > ALLOCKIT_THREAD_HEAP_MAX_SIZE
+      || align > ALLOCKIT_THREAD_HEAP_MAX_ALIGN)
+    return -1;
+
+  cls = akThreadHeapClassIndex[(bytes + 15) >> 4];
+  while (akThreadHeapClassSize[cls] % align)
+    cls++;
+
+  return (int)cls;
+}
+
+static
+AkThreadHeapPage *
+akThreadHeapPageOf(void *addr)
+{
+  return (AkThreadHeapPage *)((uintptr_t)addr
+                              & ~(uintptr_t)(ALLOCKIT_THREAD_HEAP_PAGE_SIZE
+                                             - 1));
+}
+
+static
+int
+akThreadHeapIsLarge(void *addr)
+{
+  return ((uintptr_t)addr & (ALLOCKIT_THREAD_HEAP_PAGE_SIZE - 1)) == 0;
+}
+
+static
+ALLOCKIT_SIZE_T
+akThreadHeapLargeAlign(ALLOCKIT_SIZE_T align)
+{
+  return align > ALLOCKIT_THREAD_HEAP_PAGE_SIZE
+    ? align : ALLOCKIT_THREAD_HEAP_PAGE_SIZE;
+}
+
+static
+void
+akThreadHeapExit(void *data)
+{
+  AkThreadHeapLocal *local = data;
+  AkThreadHeap *heap = local->heap;
+  unsigned int i;
+
+  pthread_mutex_lock(&heap->lock);
+
+  for (i = 0; i < ALLOCKIT_THREAD_HEAP_CLASSES; i++) {
+    AkThreadHeapPage *page = local->pages[i];
+
+    while (page) {
+      AkThreadHeapPage *next = page->next;
+
+      /* Cleared before `local` is freed, so that no other thread can
+         mistake the page for its own if it gets the same address. */
+      atomic_store_explicit(&page->owner, NULL, memory_order_relaxed);
+      page->next = heap->abandoned;
+      heap->abandoned = page;
+      page = next;
+    }
+  }
+
+  if (local->prev)
+    local->prev->next = local->next;
+  else
+    heap->locals = local->next;
+  if (local->next)
+    local->next->prev = local->prev;
+
+  pthread_mutex_unlock(&heap->lock);
+
+  ak_free_sized(heap->backing, local, AkThreadHeapLocal, 1);
+}
+
+static
+AkThreadHeapLocal *
+akThreadHeapLocal(AkThreadHeap *heap)
+{
+  AkThreadHeapLocal *local = pthread_getspecific(heap->key);
+  unsigned int i;
+
+  if (local)
+    return local;
+
+  local = ak_alloc(heap->backing, AkThreadHeapLocal, 1);
+  if (!local)
+    return NULL;
+
+  local->heap = heap;
+  for (i = 0; i < ALLOCKIT_THREAD_HEAP_CLASSES; i++) {
+    local->current[i] = NULL;
+    local->pages[i] = NULL;
+  }
+
+  if (pthread_setspecific(heap->key, local) != 0) {
+    ak_free_sized(heap->backing, local, AkThreadHeapLocal, 1);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&heap->lock);
+  local->prev = NULL;
+  local->next = heap->locals;
+  if (heap->locals)
+    heap->locals->prev = local;
+  heap->locals = local;
+  pthread_mutex_unlock(&heap->lock);
+
+  return local;
+}
+
+/* Takes a block from `page`, first moving over any blocks freed by
+   other threads if the local free list is empty. */
+static
+void *
+akThreadHeapTake(AkThreadHeapPage *page)
+{
+  void *block = page->free;
+
+  if (!block && atomic_load_explicit(&page->remote, memory_order_relaxed))
+    block = atomic_exchange_explicit(&page->remote, NULL,
+                                     memory_order_acquire);
+
+  if (block) {
+    page->free = *(void **)block;
+    return block;
+  }
+
+  if (page->bump != page->end) {
+    block = page->bump;
+    page->bump += akThreadHeapClassSize[page->cls];
+  }
+
+  return block;
+}
+
+static
+AkThreadHeapPage *
+akThreadHeapAdopt(AkThreadHeap *heap, AkThreadHeapLocal *local,
+                  unsigned int cls)
+{
+  AkThreadHeapPage **link;
+  AkThreadHeapPage *page = NULL;
+
+  pthread_mutex_lock(&heap->lock);
+  for (link = &heap->abandoned; *link; link = &(*link)->next) {
+    if ((*link)->cls == cls) {
+      page = *link;
+      *link = page->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&heap->lock);
+
+  if (page) {
+    atomic_store_explicit(&page->owner, local, memory_order_relaxed);
+    page->next = local->pages[cls];
+    local->pages[cls] = page;
+  }
+
+  return page;
+}
+
+static
+AkThreadHeapPage *
+akThreadHeapNewPage(AkThreadHeap *heap, AkThreadHeapLocal *local,
+                    unsigned int cls)
+{
+  AkThreadHeapPage *page;
+  unsigned char *base;
+  ALLOCKIT_SIZE_T size = akThreadHeapClassSize[cls];
+
+  page = ak_alloc_raw(heap->backing, ALLOCKIT_THREAD_HEAP_PAGE_SIZE,
+                      ALLOCKIT_THREAD_HEAP_PAGE_SIZE, 1);
+  if (!page)
+    return NULL;
+
+  base = (unsigned char *)page;
+  atomic_init(&page->owner, local);
+  atomic_init(&page->remote, NULL);
+  page->free = NULL;
+  page->bump = base + ALLOCKIT_THREAD_HEAP_HEADER_SIZE;
+  page->end = base + ALLOCKIT_THREAD_HEAP_PAGE_SIZE
+    - (ALLOCKIT_THREAD_HEAP_PAGE_SIZE - ALLOCKIT_THREAD_HEAP_HEADER_SIZE)
+      % size;
+  page->cls = cls;
+
+  page->next = local->pages[cls];
+  local->pages[cls] = page;
+
+  pthread_mutex_lock(&heap->lock);
+  page->all_next = heap->pages;
+  heap->pages = page;
+  pthread_mutex_unlock(&heap->lock);
+
+  return page;
+}
+
+static
+void *
+akThreadHeapAllocSlow(AkThreadHeap *heap, AkThreadHeapLocal *local,
+                      unsigned int cls)
+{
+  AkThreadHeapPage *page;
+  void *block;
+
+  for (page = local->pages[cls]; page; page = page->next) {
+    block = akThreadHeapTake(page);
+    if (block) {
+      local->current[cls] = page;
+      return block;
+    }
+  }
+
+  page = akThreadHeapAdopt(heap, local, cls);
+  if (page) {
+    block = akThreadHeapTake(page);
+    if (block) {
+      local->current[cls] = page;
+      return block;
+    }
+  }
+
+  page = akThreadHeapNewPage(heap, local, cls);
+  if (!page)
+    return NULL;
+
+  local->current[cls] = page;
+  return akThreadHeapTake(page);
+}
+
+static
+void *
+akThreadHeapAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                    ALLOCKIT_SIZE_T *usable)
+{
+  AkThreadHeap *heap = (AkThreadHeap *)alloc;
+  AkThreadHeapLocal *local;
+  AkThreadHeapPage *page;
+  void *block = NULL;
+  int cls;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+
+  cls = akThreadHeapClassOf(size * count, align);
+  if (cls < 0)
+    return ak_alloc_ex_raw(heap->backing, size * count,
+                           akThreadHeapLargeAlign(align), 1, usable);
+
+  local = akThreadHeapLocal(heap);
+  if (!local)
+    return NULL;
+
+  page = local->current[cls];
+  if (page)
+    block = akThreadHeapTake(page);
+  if (!block)
+    block = akThreadHeapAllocSlow(heap, local, (unsigned int)cls);
+
+  if (block)
+    *usable = akThreadHeapClassSize[cls];
+  return block;
+}
+
+static
+void *
+akThreadHeapAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                  ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akThreadHeapAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akThreadHeapResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                   ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkThreadHeap *heap = (AkThreadHeap *)alloc;
+  int cls;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+
+  cls = akThreadHeapClassOf(size * count, align);
+
+  if (akThreadHeapIsLarge(addr))
+    return cls < 0
+      && ak_resize_raw(heap->backing, addr, size * count,
+                       akThreadHeapLargeAlign(align), 1);
+
+  return (unsigned int)cls == akThreadHeapPageOf(addr)->cls;
+}
+
+static
+void
+akThreadHeapFree(AkAlloc *alloc, void *addr)
+{
+  AkThreadHeap *heap = (AkThreadHeap *)alloc;
+  AkThreadHeapPage *page;
+  AkThreadHeapLocal *local;
+  void *head;
+
+  if (!addr)
+    return;
+
+  if (akThreadHeapIsLarge(addr)) {
+    ak_free(heap->backing, addr);
+    return;
+  }
+
+  page = akThreadHeapPageOf(addr);
+  local = pthread_getspecific(heap->key);
+
+  if (local
+      && atomic_load_explicit(&page->owner, memory_order_relaxed) == local) {
+    *(void **)addr = page->free;
+    page->free = addr;
+    return;
+  }
+
+  head = atomic_load_explicit(&page->remote, memory_order_relaxed);
+  do {
+    *(void **)addr = head;
+  } while (!atomic_compare_exchange_weak_explicit(&page->remote, &head, addr,
+                                                  memory_order_release,
+                                                  memory_order_relaxed));
+}
+
+int
+ak_thread_heap_init(AkThreadHeap *heap, AkAlloc *backing)
+{
+  heap->alloc.alloc = akThreadHeapAlloc;
+  heap->alloc.resize = akThreadHeapResize;
+  heap->alloc.free = akThreadHeapFree;
+  heap->alloc.free_sized = NULL;
+  heap->alloc.remap = NULL;
+  heap->alloc.alloc_ex = akThreadHeapAllocEx;
+  heap->alloc.alloc_batch = NULL;
+  heap->alloc.free_batch = NULL;
+  heap->backing = backing;
+  heap->locals = NULL;
+  heap->abandoned = NULL;
+  heap->pages = NULL;
+
+  if (pthread_mutex_init(&heap->lock, NULL) != 0)
+    return 0;
+  if (pthread_key_create(&heap->key, akThreadHeapExit) != 0) {
+    pthread_mutex_destroy(&heap->lock);
+    return 0;
+  }
+
+  return 1;
+}
+
+void
+ak_thread_heap_deinit(AkThreadHeap *heap)
+{
+  AkThreadHeapLocal *local = heap->locals;
+  AkThreadHeapPage *page = heap->pages;
+
+  pthread_key_delete(heap->key);
+
+  while (local) {
+    AkThreadHeapLocal *next = local->next;
+    ak_free_sized(heap->backing, local, AkThreadHeapLocal, 1);
+    local = next;
+  }
+
+  while (page) {
+    AkThreadHeapPage *next = page->all_next;
+    ak_free(heap->backing, page);
+    page = next;
+  }
+
+  heap->locals = NULL;
+  heap->abandoned = NULL;
+  heap->pages = NULL;
+  pthread_mutex_destroy(&heap->lock);
+}
+
+#endif  /* !ALLOCKIT_THREAD_HEAP_H_IMPL */
+#endif  /* ALLOCKIT_THREAD_HEAP_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -0,0 +1,551 @@
+/* ak_tlsf.h - two-level segregated fit allocator for AllocKit
+
+   FLAGS
+     ALLOCKIT_TLSF_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_tlsf.h to emit the implementation.
+
+   USAGE
+
+       A TLSF allocator manages a caller-provided region, like the
+       fixed buffer allocator in ak_fixed_buffer.h, but lets blocks be
+       freed in any order, and both allocating and freeing take a
+       bounded amount of time, however fragmented the region becomes.
+       This makes it suitable for real-time threads, which can't
+       afford the occasional slow path of a general-purpose allocator.
+
+         #include "allockit.h"
+         #include "ak_tlsf.h"
+
+         static unsigned char region[1 << 20];
+         AkTlsf tlsf;
+
+         if (!ak_tlsf_init(&tlsf, region, sizeof(region)))
+           return -1;
+
+         Voice *voice = ak_alloc(&tlsf.alloc, Voice, 1);
+         ...
+         ak_free(&tlsf.alloc, voice);
+
+       `ak_tlsf_init` returns 0 if the region is too small to hold a
+       single block. A region can't be larger than 1 TiB (1 GiB on
+       32-bit platforms); any excess is left unused.
+
+       Free blocks are kept on segregated lists: a first level of
+       power-of-two size ranges, each split into 32 evenly spaced
+       second-level ranges. A bitmap for each level records which lists
+       are non-empty, so the list to take a block from is found with
+       two bit scans, rather than by searching. Freed blocks are merged
+       with their free neighbours straight away, using a header in
+       front of every block.
+
+       Every block is a multiple of 2 * sizeof(void *) bytes, and
+       aligned to that size. Allocations aligned to more than that
+       take a larger block and split off the part in front.
+
+       `resize` shrinks a block in place, and grows it in place when
+       the block after it is free and large enough. `ak_alloc_ex`
+       reports the whole block as usable.
+
+       The region is owned by the caller, so there is nothing to
+       deinitialize. The TLSF allocator is not thread-safe.
+
+ */
+
+#ifndef ALLOCKIT_TLSF_H_DEFS
+#define ALLOCKIT_TLSF_H_DEFS
+
+#include <stdint.h>
+
+#include "allockit.h"
+
+#if UINTPTR_MAX > 0xffffffffu
+#  define ALLOCKIT_TLSF_ALIGN_LOG2 4
+#  define ALLOCKIT_TLSF_FL_MAX 40
+#else
+#  define ALLOCKIT_TLSF_ALIGN_LOG2 3
+#  define ALLOCKIT_TLSF_FL_MAX 30
+#endif  /* UINTPTR_MAX > 0xffffffffu */
+
+#define ALLOCKIT_TLSF_SL_LOG2 5
+#define ALLOCKIT_TLSF_SL_COUNT (1 << ALLOCKIT_TLSF_SL_LOG2)
+#define ALLOCKIT_TLSF_FL_SHIFT \
+  (ALLOCKIT_TLSF_SL_LOG2 + ALLOCKIT_TLSF_ALIGN_LOG2)
+#define ALLOCKIT_TLSF_FL_COUNT \
+  (ALLOCKIT_TLSF_FL_MAX - ALLOCKIT_TLSF_FL_SHIFT + 1)
+
+typedef struct AkTlsfBlock {
+  struct AkTlsfBlock *prev_phys;
+  ALLOCKIT_SIZE_T size;
+  struct AkTlsfBlock *next_free;
+  struct AkTlsfBlock *prev_free;
+} AkTlsfBlock;
+
+typedef struct AkTlsf {
+  AkAlloc alloc;
+  uint32_t fl_bitmap;
+  uint32_t sl_bitmap[ALLOCKIT_TLSF_FL_COUNT];
+  AkTlsfBlock *blocks[ALLOCKIT_TLSF_FL_COUNT][ALLOCKIT_TLSF_SL_COUNT];
+} AkTlsf;
+
+int ak_tlsf_init(AkTlsf *tlsf, void *buf, ALLOCKIT_SIZE_T size);
+
+#endif  /* !ALLOCKIT_TLSF_H_DEFS */
+
+#ifdef ALLOCKIT_TLSF_IMPLEMENTATION
+#ifndef ALLOCKIT_TLSF_H_IMPL
+#define ALLOCKIT_TLSF_H_IMPL
+
+/* Every block starts with `prev_phys` and `size`, which make up its
+   header, followed by its payload. The free list links are only
+   valid in free blocks, and overlap the payload. `prev_phys` is only
+   valid when the previous block is free. The region ends with an
+   empty, used sentinel block, so no block is merged past it. */
+#define ALLOCKIT_TLSF_ALIGN ((ALLOCKIT_SIZE_T)1 << ALLOCKIT_TLSF_ALIGN_LOG2)
+#define ALLOCKIT_TLSF_HEADER (2 * sizeof(void *))
+#define ALLOCKIT_TLSF_MAX_SIZE \
+  (((ALLOCKIT_SIZE_T)1 << ALLOCKIT_TLSF_FL_MAX) - ALLOCKIT_TLSF_ALIGN)
+
+/* Flags kept in the low bits of `size`. */
+#define ALLOCKIT_TLSF_FREE ((ALLOCKIT_SIZE_T)1)
+#define ALLOCKIT_TLSF_PREV_FREE ((ALLOCKIT_SIZE_T)2)
+
+static
+unsigned int
+akTlsfLowestBit(uint32_t bits)
+{
+#if defined(__GNUC__)
+  return (unsigned int)__builtin_ctz(bits);
+#else
+  unsigned int i = 0;
+
+  while (!(bits & 1)) {
+    bits >>= 1;
+    i++;
+  }
+  return i;
+#endif  /* __GNUC__ */
+}
+
+static
+unsigned int
+akTlsfHighestBit(ALLOCKIT_SIZE_T bits)
+{
+#if defined(__GNUC__)
+  return (unsigned int)(sizeof(unsigned long long) * 8 - 1
+                        - __builtin_clzll((unsigned long long)bits));
+#else
+  unsigned int i = 0;
+
+  while (bits >>= 1)
+    i++;
+  return i;
+#endif  /* __GNUC__ */
+}
+
+static
+ALLOCKIT_SIZE_T
+akTlsfSize(AkTlsfBlock *block)
+{
+  return block->size & ~(ALLOCKIT_TLSF_FREE | ALLOCKIT_TLSF_PREV_FREE);
+}
+
+static
+unsigned char *
+akTlsfPayload(AkTlsfBlock *block)
+{
+  return (unsigned char *)block + ALLOCKIT_TLSF_HEADER;
+}
+
+static
+AkTlsfBlock *
+akTlsfBlockOf(void *addr)
+{
+  return (AkTlsfBlock *)((unsigned char *)addr - ALLOCKIT_TLSF_HEADER);
+}
+
+static
+AkTlsfBlock *
+akTlsfNext(AkTlsfBlock *block)
+{
+  return (AkTlsfBlock *)(akTlsfPayload(block) + akTlsfSize(block));
+}
+
+/* Finds the list that a free block of `size` bytes belongs on. */
+static
+void
+akTlsfMapping(ALLOCKIT_SIZE_T size, unsigned int *fl, unsigned int *sl)
+{
+  unsigned int high;
+
+  if (size < ((ALLOCKIT_SIZE_T)1 << ALLOCKIT_TLSF_FL_SHIFT)) {
+    *fl = 0;
+    *sl = (unsigned int)(size >> ALLOCKIT_TLSF_ALIGN_LOG2);
+    return;
+  }
+
+  high = akTlsfHighestBit(size);
+  *sl = (unsigned int)(size >> (high - ALLOCKIT_TLSF_SL_LOG2))
+        ^ ALLOCKIT_TLSF_SL_COUNT;
+  *fl = high - ALLOCKIT_TLSF_FL_SHIFT + 1;
+}
+
+static
+void
+akTlsfInsert(AkTlsf *tlsf, AkTlsfBlock *block)
+{
+  unsigned int fl, sl;
+
+  akTlsfMapping(akTlsfSize(block), &fl, &sl);
+  block->prev_free = NULL;
+  block->next_free = tlsf->blocks[fl][sl];
+  if (block->next_free)
+    block->next_free->prev_free = block;
+  tlsf->blocks[fl][sl] = block;
+  tlsf->fl_bitmap |= (uint32_t)1 << fl;
+  tlsf->sl_bitmap[fl] |= (uint32_t)1 << sl;
+}
+
+static
+void
+akTlsfRemove(AkTlsf *tlsf, AkTlsfBlock *block)
+{
+  unsigned int fl, sl;
+
+  akTlsfMapping(akTlsfSize(block), &fl, &sl);
+  if (block->prev_free)
+    block->prev_free->next_free = block->next_free;
+  else
+    tlsf->blocks[fl][sl] = block->next_free;
+  if (block->next_free)
+    block->next_free->prev_free = block->prev_free;
+
+  if (!tlsf->blocks[fl][sl]) {
+    tlsf->sl_bitmap[fl] &= ~((uint32_t)1 << sl);
+    if (!tlsf->sl_bitmap[fl])
+      tlsf->fl_bitmap &= ~((uint32_t)1 << fl);
+  }
+}
+
+/* Marks a block free in its own header and in the next block's. */
+static
+void
+akTlsfMarkFree(AkTlsfBlock *block)
+{
+  AkTlsfBlock *next = akTlsfNext(block);
+
+  block->size |= ALLOCKIT_TLSF_FREE;
+  next->prev_phys = block;
+  next->size |= ALLOCKIT_TLSF_PREV_FREE;
+}
+
+static
+void
+akTlsfMarkUsed(AkTlsfBlock *block)
+{
+  block->size &= ~ALLOCKIT_TLSF_FREE;
+  akTlsfNext(block)->size &= ~ALLOCKIT_TLSF_PREV_FREE;
+}
+
+/* Returns a free block of at least `size` bytes, taken off its list,
+   or NULL if there is none. The size is rounded up to the next list
+   boundary first, so that any block on the list found is big
+   enough. */
+static
+AkTlsfBlock *
+akTlsfTake(AkTlsf *tlsf, ALLOCKIT_SIZE_T size)
+{
+  AkTlsfBlock *block;
+  unsigned int fl, sl;
+  uint32_t sl_map, fl_map;
+
+  if (size >= ((ALLOCKIT_SIZE_T)1 << ALLOCKIT_TLSF_FL_SHIFT))
+    size += ((ALLOCKIT_SIZE_T)1 << (akTlsfHighestBit(size)
+                                    - ALLOCKIT_TLSF_SL_LOG2)) - 1;
+  akTlsfMapping(size, &fl, &sl);
+  if (fl >= ALLOCKIT_TLSF_FL_COUNT)
+    return NULL;
+
+  sl_map = tlsf->sl_bitmap[fl] & (~(uint32_t)0 << sl);
+  if (!sl_map) {
+    fl_map = fl + 1 < 32 ? tlsf->fl_bitmap & (~(uint32_t)0 << (fl + 1)) : 0;
+    if (!fl_map)
+      return NULL;
+    fl = akTlsfLowestBit(fl_map);
+    sl_map = tlsf->sl_bitmap[fl];
+  }
+  sl = akTlsfLowestBit(sl_map);
+
+  block = tlsf->blocks[fl][sl];
+  akTlsfRemove(tlsf, block);
+  return block;
+}
+
+/* Trims a used block down to `size` bytes, returning the rest to the
+   free lists if it is large enough to be a block of its own. */
+static
+void
+akTlsfTrim(AkTlsf *tlsf, AkTlsfBlock *block, ALLOCKIT_SIZE_T size)
+{
+  AkTlsfBlock *rest, *next;
+
+  if (akTlsfSize(block) < size + ALLOCKIT_TLSF_HEADER + ALLOCKIT_TLSF_ALIGN)
+    return;
+
+  rest = (AkTlsfBlock *)(akTlsfPayload(block) + size);
+  rest->size = akTlsfSize(block) - size - ALLOCKIT_TLSF_HEADER;
+  block->size = size | (block->size & ALLOCKIT_TLSF_PREV_FREE);
+
+  next = akTlsfNext(rest);
+  if (next->size & ALLOCKIT_TLSF_FREE) {
+    akTlsfRemove(tlsf, next);
+    rest->size += ALLOCKIT_TLSF_HEADER + akTlsfSize(next);
+  }
+
+  akTlsfMarkFree(rest);
+  akTlsfInsert(tlsf, rest);
+}
+
+static
+ALLOCKIT_SIZE_T
+akTlsfAdjust(ALLOCKIT_SIZE_T bytes)
+{
+  if (bytes < ALLOCKIT_TLSF_ALIGN)
+    return ALLOCKIT_TLSF_ALIGN;
+  return (bytes + ALLOCKIT_TLSF_ALIGN - 1) & ~(ALLOCKIT_TLSF_ALIGN - 1);
+}
+
+static
+void *
+akTlsfAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkTlsf *tlsf = (AkTlsf *)alloc;
+  AkTlsfBlock *block, *aligned;
+  ALLOCKIT_SIZE_T bytes, gap, min_gap = ALLOCKIT_TLSF_HEADER
+                                        + ALLOCKIT_TLSF_ALIGN;
+  uintptr_t start, addr;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (size * count > ALLOCKIT_TLSF_MAX_SIZE)
+    return NULL;
+  bytes = akTlsfAdjust(size * count);
+
+  if (align <= ALLOCKIT_TLSF_ALIGN) {
+    block = akTlsfTake(tlsf, bytes);
+    if (!block)
+      return NULL;
+  } else {
+    /* Take enough to fit an aligned block after a gap that is large
+       enough to be a free block of its own. */
+    if (align > ALLOCKIT_TLSF_MAX_SIZE - bytes - min_gap)
+      return NULL;
+    block = akTlsfTake(tlsf, bytes + align + min_gap);
+    if (!block)
+      return NULL;
+
+    start = (uintptr_t)akTlsfPayload(block);
+    addr = (start + align - 1) & ~(uintptr_t)(align - 1);
+    if (addr != start && addr - start < min_gap)
+      addr = (start + min_gap + align - 1) & ~(uintptr_t)(align - 1);
+    gap = (ALLOCKIT_SIZE_T)(addr - start);
+
+    if (gap) {
+      aligned = akTlsfBlockOf((void *)addr);
+      aligned->size = akTlsfSize(block) - gap;
+      block->size = (gap - ALLOCKIT_TLSF_HEADER)
+                    | (block->size & ALLOCKIT_TLSF_PREV_FREE);
+      akTlsfMarkFree(block);
+      akTlsfInsert(tlsf, block);
+      block = aligned;
+    }
+  }
+
+  akTlsfTrim(tlsf, block, bytes);
+  akTlsfMarkUsed(block);
+  *usable = akTlsfSize(block);
+  return akTlsfPayload(block);
+}
+
+static
+void *
+akTlsfAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+            ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T usable;
+
+  return akTlsfAllocEx(alloc, size, align, count, &usable);
+}
+
+static
+int
+akTlsfResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkTlsf *tlsf = (AkTlsf *)alloc;
+  AkTlsfBlock *block, *next;
+  ALLOCKIT_SIZE_T bytes;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  if (!addr)
+    return 0;
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return 0;
+  if (size * count > ALLOCKIT_TLSF_MAX_SIZE)
+    return 0;
+
+  block = akTlsfBlockOf(addr);
+  bytes = akTlsfAdjust(size * count);
+
+  if (bytes > akTlsfSize(block)) {
+    next = akTlsfNext(block);
+    if (!(next->size & ALLOCKIT_TLSF_FREE))
+      return 0;
+    if (akTlsfSize(block) + ALLOCKIT_TLSF_HEADER + akTlsfSize(next) < bytes)
+      return 0;
+
+    akTlsfRemove(tlsf, next);
+    block->size += ALLOCKIT_TLSF_HEADER + akTlsfSize(next);
+    akTlsfMarkUsed(block);
+  }
+
+  akTlsfTrim(tlsf, block, bytes);
+  return 1;
+}
+
+static
+void
+akTlsfFree(AkAlloc *alloc, void *addr)
+{
+  AkTlsf *tlsf = (AkTlsf *)alloc;
+  AkTlsfBlock *block, *prev, *next;
+
+  if (!addr)
+    return;
+
+  block = akTlsfBlockOf(addr);
+
+  if (block->size & ALLOCKIT_TLSF_PREV_FREE) {
+    prev = block->prev_phys;
+    akTlsfRemove(tlsf, prev);
+    prev->size += ALLOCKIT_TLSF_HEADER + akTlsfSize(block);
+    block = prev;
+  }
+
+  next = akTlsfNext(block);
+  if (next->size & ALLOCKIT_TLSF_FREE) {
+    akTlsfRemove(tlsf, next);
+    block->size += ALLOCKIT_TLSF_HEADER + akTlsfSize(next);
+  }
+
+  akTlsfMarkFree(block);
+  akTlsfInsert(tlsf, block);
+}
+
+int
+ak_tlsf_init(AkTlsf *tlsf, void *buf, ALLOCKIT_SIZE_T size)
+{
+  uintptr_t start = (uintptr_t)buf, end;
+  AkTlsfBlock *block, *sentinel;
+  unsigned int fl, sl;
+
+  tlsf->alloc.alloc = akTlsfAlloc;
+  tlsf->alloc.resize = akTlsfResize;
+  tlsf->alloc.free = akTlsfFree;
+  tlsf->alloc.free_sized = NULL;
+  tlsf->alloc.remap = NULL;
+  tlsf->alloc.alloc_ex = akTlsfAllocEx;
+  tlsf->alloc.alloc_batch = NULL;
+  tlsf->alloc.free_batch = NULL;
+  tlsf->fl_bitmap = 0;
+  for (fl = 0; fl < ALLOCKIT_TLSF_FL_COUNT; fl++) {
+    tlsf->sl_bitmap[fl] = 0;
+    for (sl = 0; sl < ALLOCKIT_TLSF_SL_COUNT; sl++)
+      tlsf->blocks[fl][sl] = NULL;
+  }
+
+  /* Blocks start one header before an aligned payload. */
+  end = start + size;
+  start = ((start + ALLOCKIT_TLSF_HEADER + ALLOCKIT_TLSF_ALIGN - 1)
+           & ~(uintptr_t)(ALLOCKIT_TLSF_ALIGN - 1)) - ALLOCKIT_TLSF_HEADER;
+  end &= ~(uintptr_t)(ALLOCKIT_TLSF_ALIGN - 1);
+  if (end < start
+      || end - start < 2 * ALLOCKIT_TLSF_HEADER + ALLOCKIT_TLSF_ALIGN)
+    return 0;
+
+  block = (AkTlsfBlock *)start;
+  block->prev_phys = NULL;
+  block->size = (ALLOCKIT_SIZE_T)(end - start) - 2 * ALLOCKIT_TLSF_HEADER;
+  block->size &= ~(ALLOCKIT_TLSF_ALIGN - 1);
+  if (block->size > ALLOCKIT_TLSF_MAX_SIZE)
+    block->size = ALLOCKIT_TLSF_MAX_SIZE;
+
+  sentinel = akTlsfNext(block);
+  sentinel->size = 0;
+  akTlsfMarkFree(block);
+  akTlsfInsert(tlsf, block);
+
+  return 1;
+}
+
+#endif  /* !ALLOCKIT_TLSF_H_IMPL */
+#endif  /* ALLOCKIT_TLSF_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
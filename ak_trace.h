@@ -0,0 +1,557 @@
+/* ak_trace.h - binary allocation trace recorder for AllocKit
+
+   FLAGS
+     ALLOCKIT_TRACE_IMPLEMENTATION
+       Define this in exactly one source file before including
+       ak_trace.h to emit the implementation. The implementation
+       requires POSIX threads, C11 atomics, POSIX file I/O and
+       `clock_gettime`, which must be compiled with _POSIX_C_SOURCE
+       at least 199309L, or _DEFAULT_SOURCE or _GNU_SOURCE, defined
+       under a strict -std=c11.
+
+     ALLOCKIT_TRACE_BUFFER (default: 4096)
+       Number of records each thread buffers before writing them to
+       the trace file.
+
+   USAGE
+
+       The trace recorder forwards every call to an inner allocator,
+       and logs each one as a fixed-size binary record, so that a
+       program's real allocation pattern can be captured once and then
+       replayed against other allocators offline.
+
+         #include "allockit.h"
+         #include "ak_trace.h"
+
+         AkTrace trace = {0};
+         if (!ak_trace_init(&trace, backing, "alloc.trace"))
+           return -1;
+
+         run_server(&trace.alloc);
+
+         ak_trace_deinit(&trace);
+
+       The file starts with an AkTraceFileHeader, followed by
+       AkTraceRecord structs, both in the byte order of the machine
+       that wrote them. Each record holds:
+
+         time
+           Nanoseconds of CLOCK_MONOTONIC since `ak_trace_init`,
+           taken before the call for `free` and `ak_free_sized`, and
+           after it otherwise.
+         addr
+           Address returned by `alloc` or `remap`, or passed to
+           `resize` or `free`. An address identifies an allocation
+           from the `alloc` that returned it to the `free` that
+           released it. It is 0 for a failed `alloc` or `remap`.
+         prev
+           Address passed to `remap`, and 0 for the other calls. The
+           old count isn't recorded, as it is the count that the
+           allocation at `prev` was last given.
+         size, count, align_log2
+           Arguments of the call, where it has them.
+         thread
+           Number of the calling thread, counted from 0 in the order
+           threads first used the recorder.
+         op, ok
+           One of the ALLOCKIT_TRACE_OP_* values below, and whether
+           the call succeeded.
+
+       `ak_alloc_ex` is recorded as an `alloc`. `ak_alloc_batch` and
+       `ak_free_batch` are recorded as one call per allocation.
+
+       A `remap` both releases `prev` and takes `addr`, and another
+       thread may free or allocate either address while it runs, so
+       no single time orders it against them. It is recorded as two
+       records with the same fields: a `remap`, timed before the call,
+       when `prev` is released, and a `remap_done`, timed after it,
+       when `addr` is taken.
+
+       Records are collected in a buffer owned by the calling thread,
+       without locks, and the buffer is appended to the file under a
+       lock when it fills up, when the thread exits, and on
+       `ak_trace_flush` and `ak_trace_deinit`. Records of different
+       threads therefore appear in the file in batches, each batch in
+       order; sort them by `time` to interleave them.
+
+       `ak_trace_deinit` flushes the buffers of all threads and closes
+       the file, so no other thread may be using the recorder when it
+       is called. It returns 0 if any write to the file failed.
+
+ */
+
+#ifndef ALLOCKIT_TRACE_H_DEFS
+#define ALLOCKIT_TRACE_H_DEFS
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "allockit.h"
+
+#ifndef ALLOCKIT_TRACE_BUFFER
+#  define ALLOCKIT_TRACE_BUFFER 4096
+#endif  /* !ALLOCKIT_TRACE_BUFFER */
+
+#define ALLOCKIT_TRACE_MAGIC "AKTRACE"
+#define ALLOCKIT_TRACE_VERSION 2
+
+#define ALLOCKIT_TRACE_OP_ALLOC 1
+#define ALLOCKIT_TRACE_OP_RESIZE 2
+#define ALLOCKIT_TRACE_OP_FREE 3
+#define ALLOCKIT_TRACE_OP_FREE_SIZED 4
+#define ALLOCKIT_TRACE_OP_REMAP 5
+#define ALLOCKIT_TRACE_OP_REMAP_DONE 6
+
+typedef struct AkTraceFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+} AkTraceFileHeader;
+
+typedef struct AkTraceRecord {
+  uint64_t time;
+  uint64_t addr;
+  uint64_t prev;
+  uint64_t size;
+  uint64_t count;
+  uint32_t thread;
+  uint8_t op;
+  uint8_t align_log2;
+  uint8_t ok;
+  uint8_t reserved;
+} AkTraceRecord;
+
+typedef struct AkTraceLocal {
+  struct AkTrace *trace;
+  struct AkTraceLocal *prev;
+  struct AkTraceLocal *next;
+  uint32_t thread;
+  unsigned used;
+  AkTraceRecord records[ALLOCKIT_TRACE_BUFFER];
+} AkTraceLocal;
+
+typedef struct AkTrace {
+  AkAlloc alloc;
+  AkAlloc *inner;
+  int fd;
+  uint64_t start;
+  pthread_key_t key;
+  pthread_mutex_t lock;
+  AkTraceLocal *locals;
+  _Atomic uint32_t threads;
+  _Atomic int failed;
+} AkTrace;
+
+int ak_trace_init(AkTrace *trace, AkAlloc *inner, const char *path);
+int ak_trace_deinit(AkTrace *trace);
+
+void ak_trace_flush(AkTrace *trace);
+
+#endif  /* !ALLOCKIT_TRACE_H_DEFS */
+
+#ifdef ALLOCKIT_TRACE_IMPLEMENTATION
+#ifndef ALLOCKIT_TRACE_H_IMPL
+#define ALLOCKIT_TRACE_H_IMPL
+
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+static
+uint64_t
+akTraceNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static
+uint8_t
+akTraceLog2(ALLOCKIT_SIZE_T n)
+{
+  uint8_t log = 0;
+
+  while (n >>= 1)
+    log++;
+  return log;
+}
+
+static
+int
+akTraceWrite(int fd, const void *data, size_t size)
+{
+  const unsigned char *p = data;
+
+  while (size) {
+    ssize_t n = write(fd, p, size);
+
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return 0;
+    }
+    p += n;
+    size -= (size_t)n;
+  }
+
+  return 1;
+}
+
+/* O_APPEND alone doesn't keep a buffer in one piece once a write comes
+   up short, so the lock is held until all of it is written. */
+static
+void
+akTraceFlushLocal(AkTrace *trace, AkTraceLocal *local)
+{
+  int ok;
+
+  if (!local->used)
+    return;
+
+  pthread_mutex_lock(&trace->lock);
+  ok = akTraceWrite(trace->fd, local->records,
+                    local->used * sizeof(AkTraceRecord));
+  pthread_mutex_unlock(&trace->lock);
+
+  if (!ok)
+    atomic_store_explicit(&trace->failed, 1, memory_order_relaxed);
+  local->used = 0;
+}
+
+static
+void
+akTraceUnlink(AkTrace *trace, AkTraceLocal *local)
+{
+  if (local->prev)
+    local->prev->next = local->next;
+  else
+    trace->locals = local->next;
+  if (local->next)
+    local->next->prev = local->prev;
+}
+
+static
+void
+akTraceExit(void *data)
+{
+  AkTraceLocal *local = data;
+  AkTrace *trace = local->trace;
+
+  akTraceFlushLocal(trace, local);
+
+  pthread_mutex_lock(&trace->lock);
+  akTraceUnlink(trace, local);
+  pthread_mutex_unlock(&trace->lock);
+
+  ak_free_sized(trace->inner, local, AkTraceLocal, 1);
+}
+
+static
+AkTraceLocal *
+akTraceLocal(AkTrace *trace)
+{
+  AkTraceLocal *local = pthread_getspecific(trace->key);
+
+  if (local)
+    return local;
+
+  local = ak_alloc(trace->inner, AkTraceLocal, 1);
+  if (!local)
+    return NULL;
+
+  local->trace = trace;
+  local->thread = atomic_fetch_add_explicit(&trace->threads, 1,
+                                            memory_order_relaxed);
+  local->used = 0;
+
+  if (pthread_setspecific(trace->key, local) != 0) {
+    ak_free_sized(trace->inner, local, AkTraceLocal, 1);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&trace->lock);
+  local->prev = NULL;
+  local->next = trace->locals;
+  if (trace->locals)
+    trace->locals->prev = local;
+  trace->locals = local;
+  pthread_mutex_unlock(&trace->lock);
+
+  return local;
+}
+
+static
+void
+akTraceRecordAt(AkTrace *trace, uint64_t time, uint8_t op, void *addr,
+                void *prev, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                ALLOCKIT_SIZE_T count, int ok)
+{
+  AkTraceLocal *local = akTraceLocal(trace);
+  AkTraceRecord *record;
+
+  if (!local) {
+    atomic_store_explicit(&trace->failed, 1, memory_order_relaxed);
+    return;
+  }
+
+  record = &local->records[local->used];
+  record->time = time - trace->start;
+  record->addr = (uint64_t)(uintptr_t)addr;
+  record->prev = (uint64_t)(uintptr_t)prev;
+  record->size = size;
+  record->count = count;
+  record->thread = local->thread;
+  record->op = op;
+  record->align_log2 = akTraceLog2(align);
+  record->ok = (uint8_t)ok;
+  record->reserved = 0;
+
+  if (++local->used == ALLOCKIT_TRACE_BUFFER)
+    akTraceFlushLocal(trace, local);
+}
+
+static
+void
+akTraceRecord(AkTrace *trace, uint8_t op, void *addr, void *prev,
+              ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+              ALLOCKIT_SIZE_T count, int ok)
+{
+  akTraceRecordAt(trace, akTraceNow(), op, addr, prev, size, align, count,
+                  ok);
+}
+
+static
+void *
+akTraceAllocEx(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+               ALLOCKIT_SIZE_T count, ALLOCKIT_SIZE_T *usable)
+{
+  AkTrace *trace = (AkTrace *)alloc;
+  void *addr;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  addr = ak_alloc_ex_raw(trace->inner, size, align, count, usable);
+  akTraceRecord(trace, ALLOCKIT_TRACE_OP_ALLOC, addr, NULL, size, align,
+                count, addr != NULL);
+  return addr;
+}
+
+static
+void *
+akTraceAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+             ALLOCKIT_SIZE_T count)
+{
+  AkTrace *trace = (AkTrace *)alloc;
+  void *addr;
+
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  addr = ak_alloc_raw(trace->inner, size, align, count);
+  akTraceRecord(trace, ALLOCKIT_TRACE_OP_ALLOC, addr, NULL, size, align,
+                count, addr != NULL);
+  return addr;
+}
+
+static
+int
+akTraceResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+              ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkTrace *trace = (AkTrace *)alloc;
+  int ok;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  ok = ak_resize_raw(trace->inner, addr, size, align, count);
+  akTraceRecord(trace, ALLOCKIT_TRACE_OP_RESIZE, addr, NULL, size, align,
+                count, ok);
+  return ok;
+}
+
+static
+void *
+akTraceRemap(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+             ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T old_count,
+             ALLOCKIT_SIZE_T count)
+{
+  AkTrace *trace = (AkTrace *)alloc;
+  uint64_t time;
+  void *moved;
+
+  ALLOCKIT_ASSERT((uintptr_t)addr % align == 0);
+
+  /* Timed before the call, like a free, as it may free addr, and the
+     result again after it, like an alloc. */
+  time = akTraceNow();
+  moved = ak_remap_raw(trace->inner, addr, size, align, old_count,
+                       count);
+  akTraceRecordAt(trace, time, ALLOCKIT_TRACE_OP_REMAP, moved, addr, size,
+                  align, count, moved != NULL);
+  akTraceRecord(trace, ALLOCKIT_TRACE_OP_REMAP_DONE, moved, addr, size,
+                align, count, moved != NULL);
+  return moved;
+}
+
+static
+void
+akTraceFree(AkAlloc *alloc, void *addr)
+{
+  AkTrace *trace = (AkTrace *)alloc;
+
+  if (!addr)
+    return;
+
+  /* Recorded first, so that the record is older than that of any
+     allocation that reuses the address. */
+  akTraceRecord(trace, ALLOCKIT_TRACE_OP_FREE, addr, NULL, 0, 1, 0, 1);
+  ak_free(trace->inner, addr);
+}
+
+static
+void
+akTraceFreeSized(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                 ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkTrace *trace = (AkTrace *)alloc;
+
+  if (!addr)
+    return;
+
+  akTraceRecord(trace, ALLOCKIT_TRACE_OP_FREE_SIZED, addr, NULL, size,
+                align, count, 1);
+  ak_free_sized_raw(trace->inner, addr, size, align, count);
+}
+
+int
+ak_trace_init(AkTrace *trace, AkAlloc *inner, const char *path)
+{
+  AkTraceFileHeader header = { ALLOCKIT_TRACE_MAGIC,
+                               ALLOCKIT_TRACE_VERSION,
+                               sizeof(AkTraceRecord) };
+
+  trace->alloc.alloc = akTraceAlloc;
+  trace->alloc.resize = akTraceResize;
+  trace->alloc.free = akTraceFree;
+  trace->alloc.free_sized = akTraceFreeSized;
+  trace->alloc.remap = akTraceRemap;
+  trace->alloc.alloc_ex = akTraceAllocEx;
+  trace->alloc.alloc_batch = NULL;
+  trace->alloc.free_batch = NULL;
+  trace->inner = inner;
+  trace->locals = NULL;
+  atomic_init(&trace->threads, 0);
+  atomic_init(&trace->failed, 0);
+
+  trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (trace->fd < 0)
+    return 0;
+  if (!akTraceWrite(trace->fd, &header, sizeof(header)))
+    goto fail_fd;
+
+  if (pthread_mutex_init(&trace->lock, NULL) != 0)
+    goto fail_fd;
+  if (pthread_key_create(&trace->key, akTraceExit) != 0)
+    goto fail_lock;
+
+  trace->start = akTraceNow();
+  return 1;
+
+fail_lock:
+  pthread_mutex_destroy(&trace->lock);
+fail_fd:
+  close(trace->fd);
+  return 0;
+}
+
+int
+ak_trace_deinit(AkTrace *trace)
+{
+  AkTraceLocal *local = trace->locals;
+
+  pthread_key_delete(trace->key);
+
+  while (local) {
+    AkTraceLocal *next = local->next;
+    akTraceFlushLocal(trace, local);
+    ak_free_sized(trace->inner, local, AkTraceLocal, 1);
+    local = next;
+  }
+
+  trace->locals = NULL;
+  pthread_mutex_destroy(&trace->lock);
+
+  if (close(trace->fd) != 0)
+    atomic_store_explicit(&trace->failed, 1, memory_order_relaxed);
+  return !atomic_load_explicit(&trace->failed, memory_order_relaxed);
+}
+
+void
+ak_trace_flush(AkTrace *trace)
+{
+  AkTraceLocal *local = pthread_getspecific(trace->key);
+
+  if (local)
+    akTraceFlushLocal(trace, local);
+}
+
+#endif  /* !ALLOCKIT_TRACE_H_IMPL */
+#endif  /* ALLOCKIT_TRACE_IMPLEMENTATION */
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */
@@ -7,6 +7,15 @@
        library. If ALLOCKIT_ALIGNOF is not defined, stdalign.h is
        used. If ALLOCKIT_SIZE_T is not defined, stddef.h is used.
 
+     ALLOCKIT_ASSERT (default: assert)
+       Macro used by allocator implementations for debug checks. If
+       ALLOCKIT_ASSERT is not defined, assert.h is used.
+
+     ALLOCKIT_MEMCPY (default: memcpy)
+       Macro used by `ak_remap` to copy an allocation that could not
+       be resized in place. If ALLOCKIT_MEMCPY is not defined,
+       string.h is used.
+
    USAGE
 
      Using AllocKit Allocators
@@ -49,19 +58,62 @@
            int *heap_list = ak_alloc(&my_allocator.alloc, int, 10)
            do_work(&my_allocator.alloc);
 
+       Many allocators round allocations up, to a size class or to a
+       whole page. `ak_alloc_ex` works like `ak_alloc`, but also
+       stores the number of bytes actually usable at the returned
+       address, which is at least the number requested. The whole of
+       that space may be used, and the allocation may then be resized
+       or freed as if that many bytes were requested.
+
+           size_t usable;
+           char *str = ak_alloc_ex(&my_allocator.alloc, char, 100, &usable);
+
        To resize our allocation (similar to realloc) we'll use
        `ak_resize`. Since resizing an allocation won't always succeed,
        we need to check its return result to ensure the operation was
        successful. In this trivial example we'll just exit the program
        with an error code.
 
-           if (!ak_resize(&my_allocator.alloc, int, 20))
+           if (!ak_resize(&my_allocator.alloc, heap_list, int, 20))
+             return 1;
+
+       `ak_resize` never moves the allocation. If you don't mind it
+       moving, use `ak_remap` instead, which also takes the current
+       count and returns the (possibly new) address of the
+       allocation, or NULL on failure. The allocator picks the
+       cheapest way to do this, falling back to allocating, copying,
+       and freeing when nothing better is possible. On failure the
+       original allocation is left untouched.
+
+           int *grown = ak_remap(&my_allocator.alloc, heap_list, int, 20, 40);
+           if (!grown)
              return 1;
+           heap_list = grown;
 
        Finally, to free our allocation we use `ak_free`.
 
            ak_free(&my_allocator.alloc, heap_list);
 
+       If you still know the size of an allocation when freeing it,
+       you can use `ak_free_sized` instead, passing the same type and
+       count as the allocation was made (or last resized) with. Some
+       allocators can free faster when they don't need to look up the
+       size themselves.
+
+           ak_free_sized(&my_allocator.alloc, heap_list, int, 40);
+
+       When allocating or freeing many allocations of the same size
+       at once, `ak_alloc_batch` and `ak_free_batch` do so with a
+       single call into the allocator. `ak_alloc_batch` returns how
+       many allocations it made, which may be fewer than requested if
+       the allocator runs out of memory.
+
+           Packet *pkts[32];
+           size_t n = ak_alloc_batch(&my_allocator.alloc, Packet, 1,
+                                     (void **)pkts, 32);
+           ...
+           ak_free_batch(&my_allocator.alloc, (void **)pkts, n, Packet, 1);
+
        After we're done using our allocator, it may have resources it
        cannot yet free (depending on the allocator), so some
        allocators may provide a "deinit" or "destroy" function. If the
@@ -77,8 +129,8 @@
 
        Writing an AllocKit allocator is a touch more complicated than
        using one, but I've endeavored to make it as simple as
-       possible. There are currently no examples, but that will change
-       soon.
+       possible. The allocators shipped alongside this header (such
+       as ak_arena.h) are written to serve as examples.
 
        IMPORTANT: It is the responsibility of the allocator to ensure
        thread-safety, AllocKit provides no guarantees in this regard.
@@ -90,18 +142,25 @@
            void *(*alloc)(AkAlloc *, size_t, size_t, size_t);
            int (*resize)(AkAlloc *, void *, size_t, size_t, size_t);
            void (*free)(AkAlloc *, void *);
+           void (*free_sized)(AkAlloc *, void *, size_t, size_t, size_t);
+           void *(*remap)(AkAlloc *, void *, size_t, size_t, size_t, size_t);
+           void *(*alloc_ex)(AkAlloc *, size_t, size_t, size_t, size_t *);
+           size_t (*alloc_batch)(AkAlloc *, size_t, size_t, size_t,
+                                 void **, size_t);
+           void (*free_batch)(AkAlloc *, void **, size_t,
+                              size_t, size_t, size_t);
          } AkAlloc;
 
        To create an allocator, you must simply implement this
        struct. Of course, there are several notes and tricks to keep
        in mind.
 
-       The trio of `size_t`s in the arguments of `alloc` and `resize`
-       are the size, alignment, and count of the allocation requested,
-       respectively.
+       The trio of `size_t`s in the arguments of `alloc`, `resize`
+       and `free_sized` are the size, alignment, and count of the
+       allocation requested, respectively.
 
-       The void pointer argument in `resize` and `free` is the address
-       of the existing allocation.
+       The void pointer argument in `resize`, `free` and `free_sized`
+       is the address of the existing allocation.
 
        The `AkAlloc *` argument is included to make a simple trick
        possible: It's common to need to hold state or some sort of
@@ -131,7 +190,7 @@
 
        Let's go into more detail on each of those functions.
 
-       IMPORTANT: None of these function pointers may be left NULL
+       IMPORTANT: None of `alloc`, `resize` or `free` may be left NULL
        after calling your "init" function. It is EXPLICITLY an error
        on the implementor's part if one is left so, and will lead to
        undefined behavior when the null pointer is dereferenced at
@@ -174,9 +233,9 @@
 
        When implementing `resize`, it's recommended to add a debug
        check to ensure that the alignment matches the existing
-       allocation. This is fairly simple with <stdassert.h>:
+       allocation. This is fairly simple with ALLOCKIT_ASSERT:
 
-         assert((uintptr_t)addr % align == 0)
+         ALLOCKIT_ASSERT((uintptr_t)addr % align == 0)
 
        `resize` should attempt to resize the allocation at `addr` to
        the size `size * count`, maintaining the alignment `align`. If
@@ -197,6 +256,87 @@
        are incapable of freeing memory in some or all cases. For these
        allocators, free should just no-op, returning immediately.
 
+         void (*free_sized)(AkAlloc *, void *, size_t, size_t, size_t);
+
+         static
+         void
+         myFreeSized(AkAlloc *alloc, void *addr, size_t size, size_t align, size_t count)
+         { ... }
+
+       `free_sized` is the same as `free`, but is also passed the
+       size, alignment, and count that the allocation at `addr` was
+       made (or last successfully resized) with. Allocators that would
+       otherwise need a header or a lookup to find the size of an
+       allocation when freeing it can use these instead.
+
+       Unlike the members above, `free_sized` is optional. If it is
+       left NULL, `ak_free_sized` falls back to calling `free`.
+
+         void *(*remap)(AkAlloc *, void *, size_t, size_t, size_t, size_t);
+
+         static
+         void *
+         myRemap(AkAlloc *alloc, void *addr, size_t size, size_t align,
+                 size_t old_count, size_t count)
+         { ... }
+
+       `remap` changes the size of the allocation at `addr` from
+       `size * old_count` to `size * count` bytes, moving it if
+       necessary, and returns its new address. On failure it returns
+       NULL and leaves the allocation untouched. It's worth
+       implementing when the allocator can move an allocation more
+       cheaply than by copying it, such as with `mremap`.
+
+       `remap` is optional too. If it is left NULL, `ak_remap` calls
+       `ak_remap_fallback`, which tries `resize` and otherwise
+       allocates, copies and frees. Implementations of `remap` may
+       also call `ak_remap_fallback` for the cases they don't handle
+       themselves.
+
+         void *(*alloc_ex)(AkAlloc *, size_t, size_t, size_t, size_t *);
+
+         static
+         void *
+         myAllocEx(AkAlloc *alloc, size_t size, size_t align, size_t count,
+                   size_t *usable)
+         { ... }
+
+       `alloc_ex` is the same as `alloc`, but on success also stores
+       in `*usable` the number of bytes the caller may use, which
+       must be at least `size * count`. Any size between the two must
+       then be accepted by `resize` and `free_sized` for that
+       allocation.
+
+       `alloc_ex` is optional. If it is left NULL, `ak_alloc_ex`
+       calls `alloc` and reports exactly `size * count` bytes.
+
+         size_t (*alloc_batch)(AkAlloc *, size_t, size_t, size_t,
+                               void **, size_t);
+         void (*free_batch)(AkAlloc *, void **, size_t,
+                            size_t, size_t, size_t);
+
+         static
+         size_t
+         myAllocBatch(AkAlloc *alloc, size_t size, size_t align,
+                      size_t count, void **addrs, size_t n)
+         { ... }
+
+         static
+         void
+         myFreeBatch(AkAlloc *alloc, void **addrs, size_t n,
+                     size_t size, size_t align, size_t count)
+         { ... }
+
+       `alloc_batch` makes up to `n` allocations, as if by `alloc`,
+       storing their addresses in `addrs` and returning how many it
+       made. `free_batch` frees the `n` allocations in `addrs`, as if
+       by `free_sized`. Allocators that keep free lists can use these
+       to move whole runs of blocks at a time, and allocators that
+       lock can take the lock only once.
+
+       Both are optional. If they are left NULL, `ak_alloc_batch` and
+       `ak_free_batch` loop over `alloc` and `free_sized`.
+
  */
 
 #ifndef ALLOCKIT_H_DEFS
@@ -212,6 +352,16 @@
 #  define ALLOCKIT_SIZE_T size_t
 #endif  /* !ALLOCKIT_SIZE_T */
 
+#ifndef ALLOCKIT_ASSERT
+#  include <assert.h>
+#  define ALLOCKIT_ASSERT assert
+#endif  /* !ALLOCKIT_ASSERT */
+
+#ifndef ALLOCKIT_MEMCPY
+#  include <string.h>
+#  define ALLOCKIT_MEMCPY memcpy
+#endif  /* !ALLOCKIT_MEMCPY */
+
 typedef struct AkAlloc {
   void *(*alloc)(struct AkAlloc *,
                  ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T);
@@ -220,21 +370,138 @@ typedef struct AkAlloc {
                 ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T);
   void (*free)(struct AkAlloc *,
                void *);
+  void (*free_sized)(struct AkAlloc *,
+                     void *,
+                     ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T);
+  void *(*remap)(struct AkAlloc *,
+                 void *,
+                 ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T,
+                 ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T);
+  void *(*alloc_ex)(struct AkAlloc *,
+                    ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T,
+                    ALLOCKIT_SIZE_T *);
+  ALLOCKIT_SIZE_T (*alloc_batch)(struct AkAlloc *,
+                                 ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T,
+                                 ALLOCKIT_SIZE_T,
+                                 void **, ALLOCKIT_SIZE_T);
+  void (*free_batch)(struct AkAlloc *,
+                     void **, ALLOCKIT_SIZE_T,
+                     ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T, ALLOCKIT_SIZE_T);
 } AkAlloc;
 
 #define ak_alloc_raw(pAlloc, Size, Align, Count) \
   (((pAlloc)->alloc)((pAlloc), Size, Align, Count))
 #define ak_alloc(pAlloc, T, Count) \
-  ak_alloc(pAlloc, sizeof(T), ALLOCKIT_ALIGNOF(T), Count)
+  ak_alloc_raw(pAlloc, sizeof(T), ALLOCKIT_ALIGNOF(T), Count)
+
+static inline
+void *
+ak_alloc_ex_fallback(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                     ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                     ALLOCKIT_SIZE_T *usable)
+{
+  void *addr = ak_alloc_raw(alloc, size, align, count);
+
+  if (addr)
+    *usable = size * count;
+  return addr;
+}
+
+#define ak_alloc_ex_raw(pAlloc, Size, Align, Count, pUsable) \
+  ((pAlloc)->alloc_ex \
+   ? ((pAlloc)->alloc_ex)((pAlloc), Size, Align, Count, pUsable) \
+   : ak_alloc_ex_fallback((pAlloc), Size, Align, Count, pUsable))
+#define ak_alloc_ex(pAlloc, T, Count, pUsable) \
+  ak_alloc_ex_raw(pAlloc, sizeof(T), ALLOCKIT_ALIGNOF(T), Count, pUsable)
 
 #define ak_resize_raw(pAlloc, Addr, Size, Align, Count) \
-  (((Alloc)->resize)((pAlloc), Addr, Size, Align, Count))
+  (((pAlloc)->resize)((pAlloc), Addr, Size, Align, Count))
 #define ak_resize(pAlloc, Addr, T, Count) \
-  ak_resize(pAlloc, Addr, sizeof(T), ALLOCKIT_ALIGNOF(T), Count)
+  ak_resize_raw(pAlloc, Addr, sizeof(T), ALLOCKIT_ALIGNOF(T), Count)
 
 #define ak_free(pAlloc, Addr) \
   (((pAlloc)->free)((pAlloc), Addr))
 
+#define ak_free_sized_raw(pAlloc, Addr, Size, Align, Count) \
+  ((pAlloc)->free_sized \
+   ? ((pAlloc)->free_sized)((pAlloc), Addr, Size, Align, Count) \
+   : ((pAlloc)->free)((pAlloc), Addr))
+#define ak_free_sized(pAlloc, Addr, T, Count) \
+  ak_free_sized_raw(pAlloc, Addr, sizeof(T), ALLOCKIT_ALIGNOF(T), Count)
+
+static inline
+void *
+ak_remap_fallback(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                  ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T old_count,
+                  ALLOCKIT_SIZE_T count)
+{
+  void *moved;
+
+  if (!addr)
+    return ak_alloc_raw(alloc, size, align, count);
+  if (ak_resize_raw(alloc, addr, size, align, count))
+    return addr;
+
+  moved = ak_alloc_raw(alloc, size, align, count);
+  if (!moved)
+    return NULL;
+
+  ALLOCKIT_MEMCPY(moved, addr,
+                  size * (old_count < count ? old_count : count));
+  ak_free_sized_raw(alloc, addr, size, align, old_count);
+  return moved;
+}
+
+#define ak_remap_raw(pAlloc, Addr, Size, Align, OldCount, Count) \
+  ((pAlloc)->remap \
+   ? ((pAlloc)->remap)((pAlloc), Addr, Size, Align, OldCount, Count) \
+   : ak_remap_fallback((pAlloc), Addr, Size, Align, OldCount, Count))
+#define ak_remap(pAlloc, Addr, T, OldCount, Count) \
+  ak_remap_raw(pAlloc, Addr, sizeof(T), ALLOCKIT_ALIGNOF(T), OldCount, Count)
+
+static inline
+ALLOCKIT_SIZE_T
+ak_alloc_batch_fallback(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                        ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count,
+                        void **addrs, ALLOCKIT_SIZE_T n)
+{
+  ALLOCKIT_SIZE_T i;
+
+  for (i = 0; i < n; i++) {
+    addrs[i] = ak_alloc_raw(alloc, size, align, count);
+    if (!addrs[i])
+      break;
+  }
+
+  return i;
+}
+
+static inline
+void
+ak_free_batch_fallback(AkAlloc *alloc, void **addrs, ALLOCKIT_SIZE_T n,
+                       ALLOCKIT_SIZE_T size, ALLOCKIT_SIZE_T align,
+                       ALLOCKIT_SIZE_T count)
+{
+  ALLOCKIT_SIZE_T i;
+
+  for (i = 0; i < n; i++)
+    ak_free_sized_raw(alloc, addrs[i], size, align, count);
+}
+
+#define ak_alloc_batch_raw(pAlloc, Size, Align, Count, Addrs, N) \
+  ((pAlloc)->alloc_batch \
+   ? ((pAlloc)->alloc_batch)((pAlloc), Size, Align, Count, Addrs, N) \
+   : ak_alloc_batch_fallback((pAlloc), Size, Align, Count, Addrs, N))
+#define ak_alloc_batch(pAlloc, T, Count, Addrs, N) \
+  ak_alloc_batch_raw(pAlloc, sizeof(T), ALLOCKIT_ALIGNOF(T), Count, Addrs, N)
+
+#define ak_free_batch_raw(pAlloc, Addrs, N, Size, Align, Count) \
+  ((pAlloc)->free_batch \
+   ? ((pAlloc)->free_batch)((pAlloc), Addrs, N, Size, Align, Count) \
+   : ak_free_batch_fallback((pAlloc), Addrs, N, Size, Align, Count))
+#define ak_free_batch(pAlloc, Addrs, N, T, Count) \
+  ak_free_batch_raw(pAlloc, Addrs, N, sizeof(T), ALLOCKIT_ALIGNOF(T), Count)
+
 #endif  /* !ALLOCKIT_H_DEFS */
 
 /*
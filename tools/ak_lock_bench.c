@@ -0,0 +1,477 @@
+/* ak_lock_bench.c - lock crossover benchmark for AllocKit
+
+   BUILDING
+
+       From the root of the repository, on Linux:
+
+         cc -O2 -I. -o ak_lock_bench tools/ak_lock_bench.c -lpthread
+
+   USAGE
+
+       ak_lock_bench runs threads that allocate and free through
+       `AkLocked` from ak_locked.h, with each of its locks in turn,
+       over a sweep of thread counts and of how long the lock is held,
+       and prints where each lock stops being the cheapest.
+
+         $ ak_lock_bench
+         $ ak_lock_bench -t 64 -h 0,50,200,1000 -d 500
+
+       Options:
+
+         -t THREADS
+           Largest number of threads (default: twice the number of
+           CPUs). The sweep doubles from 1 up to it. Going past the
+           number of CPUs shows how each lock behaves when a holder is
+           descheduled.
+         -h NS,...
+           Hold times to sweep, in nanoseconds (default:
+           0,25,100,400,1600). Each `alloc` and `free` holds the lock
+           for this long, in the inner allocator.
+         -w NS
+           Time each thread spends outside the lock after each call
+           (default: 100), standing in for the work a program does
+           between allocations.
+         -d MS
+           Duration of each run (default: 100).
+
+       The inner allocator does no allocation. It holds the lock by
+       writing to a few words of shared data in a loop, as a real
+       allocator would write its metadata, so that the cache line
+       moves between CPUs with the lock. Hold and work times are
+       converted to iterations of that loop, timed once on a single
+       thread at startup, so they are approximate.
+
+       It reports, for each hold time and thread count, the calls per
+       second made through each lock by all threads together, and which
+       lock made the most. It then lists, for each hold time, the
+       thread counts from which another lock is the cheapest, and for
+       each thread count, the hold times from which another lock is
+       the cheapest.
+
+       ALLOCKIT_LOCKED_LOCK is a compile-time flag that changes the
+       layout of `AkLocked`, so the tool includes ak_locked.h once for
+       each lock, renaming its identifiers each time.
+
+ */
+
+#ifdef AK_LOCK_BENCH_VARIANT
+
+/* Included once for each lock, with ALLOCKIT_LOCKED_LOCK and
+   AK_LOCK_BENCH_VARIANT set, and the identifiers of ak_locked.h
+   renamed after the variant. */
+
+#undef ALLOCKIT_LOCKED_H_DEFS
+#undef ALLOCKIT_LOCKED_H_IMPL
+#include "ak_locked.h"
+
+static AkLocked AK_LOCK_BENCH_NAME(akLockBenchLocked);
+
+static
+AkAlloc *
+AK_LOCK_BENCH_NAME(akLockBenchInit)(AkAlloc *inner)
+{
+  ak_locked_init(&AK_LOCK_BENCH_NAME(akLockBenchLocked), inner);
+  return &AK_LOCK_BENCH_NAME(akLockBenchLocked).alloc;
+}
+
+static
+void
+AK_LOCK_BENCH_NAME(akLockBenchDeinit)(void)
+{
+  ak_locked_deinit(&AK_LOCK_BENCH_NAME(akLockBenchLocked));
+}
+
+#else
+
+#define _GNU_SOURCE
+
+#define ALLOCKIT_LOCKED_IMPLEMENTATION
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allockit.h"
+
+#define AK_LOCK_BENCH_CAT2(a, b) a##b
+#define AK_LOCK_BENCH_CAT(a, b) AK_LOCK_BENCH_CAT2(a, b)
+#define AK_LOCK_BENCH_NAME(name) \
+  AK_LOCK_BENCH_CAT(name, AK_LOCK_BENCH_VARIANT)
+
+#define AkLocked AK_LOCK_BENCH_NAME(AkLocked)
+#define AkLockedLock AK_LOCK_BENCH_NAME(AkLockedLock)
+#define ak_locked_init AK_LOCK_BENCH_NAME(ak_locked_init)
+#define ak_locked_deinit AK_LOCK_BENCH_NAME(ak_locked_deinit)
+#define akLockedAcquire AK_LOCK_BENCH_NAME(akLockedAcquire)
+#define akLockedRelease AK_LOCK_BENCH_NAME(akLockedRelease)
+#define akLockedLockInit AK_LOCK_BENCH_NAME(akLockedLockInit)
+#define akLockedFutex AK_LOCK_BENCH_NAME(akLockedFutex)
+#define akLockedAlloc AK_LOCK_BENCH_NAME(akLockedAlloc)
+#define akLockedResize AK_LOCK_BENCH_NAME(akLockedResize)
+#define akLockedFree AK_LOCK_BENCH_NAME(akLockedFree)
+#define akLockedFreeSized AK_LOCK_BENCH_NAME(akLockedFreeSized)
+#define akLockedRemap AK_LOCK_BENCH_NAME(akLockedRemap)
+#define akLockedAllocEx AK_LOCK_BENCH_NAME(akLockedAllocEx)
+#define akLockedAllocBatch AK_LOCK_BENCH_NAME(akLockedAllocBatch)
+#define akLockedFreeBatch AK_LOCK_BENCH_NAME(akLockedFreeBatch)
+
+#define AK_LOCK_BENCH_VARIANT Spin
+#define ALLOCKIT_LOCKED_LOCK ALLOCKIT_LOCKED_SPIN
+#include "ak_lock_bench.c"
+#undef AK_LOCK_BENCH_VARIANT
+#undef ALLOCKIT_LOCKED_LOCK
+
+#define AK_LOCK_BENCH_VARIANT Ticket
+#define ALLOCKIT_LOCKED_LOCK ALLOCKIT_LOCKED_TICKET
+#include "ak_lock_bench.c"
+#undef AK_LOCK_BENCH_VARIANT
+#undef ALLOCKIT_LOCKED_LOCK
+
+#define AK_LOCK_BENCH_VARIANT Futex
+#define ALLOCKIT_LOCKED_LOCK ALLOCKIT_LOCKED_FUTEX
+#include "ak_lock_bench.c"
+#undef AK_LOCK_BENCH_VARIANT
+#undef ALLOCKIT_LOCKED_LOCK
+
+/* Most hold times and thread counts in a sweep, and most threads in a
+   run. */
+#define AK_LOCK_BENCH_MAX_HOLDS 16
+#define AK_LOCK_BENCH_MAX_COUNTS 32
+#define AK_LOCK_BENCH_MAX_THREADS 1024
+
+#define AK_LOCK_BENCH_LOCKS \
+  (sizeof(akLockBenchLocks) / sizeof(akLockBenchLocks[0]))
+
+typedef struct AkLockBenchLock {
+  const char *name;
+  AkAlloc *(*init)(AkAlloc *inner);
+  void (*deinit)(void);
+} AkLockBenchLock;
+
+typedef struct AkLockBenchInner {
+  AkAlloc alloc;
+  unsigned long hold;
+  volatile unsigned long shared[8];
+  unsigned char block[64];
+} AkLockBenchInner;
+
+typedef struct AkLockBenchRun {
+  AkAlloc *alloc;
+  unsigned long work;
+  atomic_int go;
+  atomic_int stop;
+  atomic_ulong calls;
+} AkLockBenchRun;
+
+static const AkLockBenchLock akLockBenchLocks[] = {
+  { "spin", akLockBenchInitSpin, akLockBenchDeinitSpin },
+  { "ticket", akLockBenchInitTicket, akLockBenchDeinitTicket },
+  { "futex", akLockBenchInitFutex, akLockBenchDeinitFutex },
+};
+
+static
+uint64_t
+akLockBenchNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static
+void
+akLockBenchSpin(volatile unsigned long *words, unsigned long n)
+{
+  unsigned long i;
+
+  for (i = 0; i < n; i++)
+    words[i & 7]++;
+}
+
+/* Returns the time one iteration of akLockBenchSpin takes, in
+   nanoseconds. */
+static
+double
+akLockBenchCalibrate(void)
+{
+  volatile unsigned long words[8] = {0};
+  unsigned long n = 1ul << 24;
+  uint64_t start;
+
+  start = akLockBenchNow();
+  akLockBenchSpin(words, n);
+  return (double)(akLockBenchNow() - start) / (double)n;
+}
+
+/* Inner allocator. */
+
+static
+void *
+akLockBenchInnerAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                      ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  AkLockBenchInner *inner = (AkLockBenchInner *)alloc;
+
+  (void)size;
+  (void)align;
+  (void)count;
+  akLockBenchSpin(inner->shared, inner->hold);
+  return inner->block;
+}
+
+static
+int
+akLockBenchInnerResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                       ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  (void)alloc;
+  (void)addr;
+  (void)size;
+  (void)align;
+  (void)count;
+  return 0;
+}
+
+static
+void
+akLockBenchInnerFree(AkAlloc *alloc, void *addr)
+{
+  AkLockBenchInner *inner = (AkLockBenchInner *)alloc;
+
+  (void)addr;
+  akLockBenchSpin(inner->shared, inner->hold);
+}
+
+static AkLockBenchInner akLockBenchInner = {
+  {
+    akLockBenchInnerAlloc, akLockBenchInnerResize, akLockBenchInnerFree,
+    NULL, NULL, NULL, NULL, NULL
+  },
+  0, {0}, {0}
+};
+
+/* Runs. */
+
+static
+void *
+akLockBenchWorker(void *arg)
+{
+  AkLockBenchRun *run = arg;
+  volatile unsigned long local[8] = {0};
+  unsigned long calls = 0;
+  void *addr;
+
+  while (!atomic_load_explicit(&run->go, memory_order_acquire))
+    sched_yield();
+
+  while (!atomic_load_explicit(&run->stop, memory_order_relaxed)) {
+    addr = ak_alloc_raw(run->alloc, 64, 16, 1);
+    akLockBenchSpin(local, run->work);
+    ak_free(run->alloc, addr);
+    akLockBenchSpin(local, run->work);
+    calls += 2;
+  }
+
+  atomic_fetch_add_explicit(&run->calls, calls, memory_order_relaxed);
+  return NULL;
+}
+
+/* Returns the calls per second made through `alloc` by `threads`
+   threads together, or a negative number if they couldn't be
+   started. */
+static
+double
+akLockBenchRun(AkAlloc *alloc, unsigned threads, unsigned long work,
+               uint64_t duration)
+{
+  pthread_t tids[AK_LOCK_BENCH_MAX_THREADS];
+  AkLockBenchRun run;
+  struct timespec ts;
+  uint64_t start, elapsed;
+  unsigned i, started;
+
+  run.alloc = alloc;
+  run.work = work;
+  atomic_init(&run.go, 0);
+  atomic_init(&run.stop, 0);
+  atomic_init(&run.calls, 0);
+
+  for (started = 0; started < threads; started++)
+    if (pthread_create(&tids[started], NULL, akLockBenchWorker, &run))
+      break;
+
+  ts.tv_sec = (time_t)(duration / 1000000000u);
+  ts.tv_nsec = (long)(duration % 1000000000u);
+
+  start = akLockBenchNow();
+  atomic_store_explicit(&run.go, 1, memory_order_release);
+  if (started == threads)
+    while (nanosleep(&ts, &ts))
+      ;
+  atomic_store_explicit(&run.stop, 1, memory_order_relaxed);
+  elapsed = akLockBenchNow() - start;
+
+  for (i = 0; i < started; i++)
+    pthread_join(tids[i], NULL);
+
+  if (started < threads)
+    return -1;
+  return (double)atomic_load(&run.calls) * 1e9 / (double)elapsed;
+}
+
+/* Reporting. */
+
+static
+unsigned
+akLockBenchCheapest(const double *rates)
+{
+  unsigned i, best = 0;
+
+  for (i = 1; i < AK_LOCK_BENCH_LOCKS; i++)
+    if (rates[i] > rates[best])
+      best = i;
+  return best;
+}
+
+static
+void
+akLockBenchUsage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-t max_threads] [-h hold_ns,...] "
+                  "[-w work_ns] [-d ms]\n", argv0);
+}
+
+int
+main(int argc, char **argv)
+{
+  static double rates[AK_LOCK_BENCH_MAX_HOLDS][AK_LOCK_BENCH_MAX_COUNTS]
+                     [AK_LOCK_BENCH_LOCKS];
+  unsigned long holds[AK_LOCK_BENCH_MAX_HOLDS] = { 0, 25, 100, 400, 1600 };
+  unsigned counts[AK_LOCK_BENCH_MAX_COUNTS];
+  size_t nholds = 5, ncounts = 0, h, c, l;
+  unsigned long work = 100, work_spins, max_threads = 0;
+  uint64_t duration = 100000000u;
+  unsigned best, prev;
+  double ns_per_spin;
+  char *s, *end;
+  AkAlloc *alloc;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:h:w:d:")) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'h':
+      for (nholds = 0, s = optarg; *s && nholds < AK_LOCK_BENCH_MAX_HOLDS;
+           s = *end ? end + 1 : end) {
+        holds[nholds++] = strtoul(s, &end, 10);
+        if (end == s || (*end && *end != ',')) {
+          akLockBenchUsage(argv[0]);
+          return 2;
+        }
+      }
+      break;
+    case 'w':
+      work = strtoul(optarg, NULL, 10);
+      break;
+    case 'd':
+      duration = (uint64_t)strtoull(optarg, NULL, 10) * 1000000u;
+      break;
+    default:
+      akLockBenchUsage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc || !nholds || !duration) {
+    akLockBenchUsage(argv[0]);
+    return 2;
+  }
+
+  if (!max_threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = cpus > 0 ? 2 * (unsigned long)cpus : 2;
+  }
+  if (max_threads > AK_LOCK_BENCH_MAX_THREADS)
+    max_threads = AK_LOCK_BENCH_MAX_THREADS;
+  for (c = 1; c < max_threads && ncounts < AK_LOCK_BENCH_MAX_COUNTS - 1;
+       c *= 2)
+    counts[ncounts++] = (unsigned)c;
+  counts[ncounts++] = (unsigned)max_threads;
+
+  ns_per_spin = akLockBenchCalibrate();
+  if (ns_per_spin <= 0)
+    ns_per_spin = 1;
+  work_spins = (unsigned long)(work / ns_per_spin);
+
+  printf("hold loop      %.2f ns per iteration\n", ns_per_spin);
+  printf("work           %lu ns outside the lock after each call\n", work);
+  printf("\nMcalls/s through AkLocked, all threads together\n\n");
+  printf("%8s %8s", "hold ns", "threads");
+  for (l = 0; l < AK_LOCK_BENCH_LOCKS; l++)
+    printf(" %9s", akLockBenchLocks[l].name);
+  printf("  cheapest\n");
+
+  for (h = 0; h < nholds; h++) {
+    akLockBenchInner.hold = (unsigned long)(holds[h] / ns_per_spin);
+    for (c = 0; c < ncounts; c++) {
+      printf("%8lu %8u", holds[h], counts[c]);
+      fflush(stdout);
+      for (l = 0; l < AK_LOCK_BENCH_LOCKS; l++) {
+        alloc = akLockBenchLocks[l].init(&akLockBenchInner.alloc);
+        rates[h][c][l] = akLockBenchRun(alloc, counts[c], work_spins,
+                                        duration);
+        akLockBenchLocks[l].deinit();
+        if (rates[h][c][l] < 0) {
+          fprintf(stderr, "\n%s: could not start %u threads\n", argv[0],
+                  counts[c]);
+          return 1;
+        }
+        printf(" %9.2f", rates[h][c][l] / 1e6);
+        fflush(stdout);
+      }
+      best = akLockBenchCheapest(rates[h][c]);
+      printf("  %s\n", akLockBenchLocks[best].name);
+    }
+  }
+
+  printf("\nCheapest lock by hold time, as threads are added\n\n");
+  for (h = 0; h < nholds; h++) {
+    prev = akLockBenchCheapest(rates[h][0]);
+    printf("  %lu ns: %s", holds[h], akLockBenchLocks[prev].name);
+    for (c = 1; c < ncounts; c++) {
+      best = akLockBenchCheapest(rates[h][c]);
+      if (best != prev)
+        printf(", %s from %u threads", akLockBenchLocks[best].name,
+               counts[c]);
+      prev = best;
+    }
+    printf("\n");
+  }
+
+  printf("\nCheapest lock by thread count, as the hold time grows\n\n");
+  for (c = 0; c < ncounts; c++) {
+    prev = akLockBenchCheapest(rates[0][c]);
+    printf("  %u thread%s: %s", counts[c], counts[c] == 1 ? "" : "s",
+           akLockBenchLocks[prev].name);
+    for (h = 1; h < nholds; h++) {
+      best = akLockBenchCheapest(rates[h][c]);
+      if (best != prev)
+        printf(", %s from %lu ns", akLockBenchLocks[best].name, holds[h]);
+      prev = best;
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
+
+#endif  /* AK_LOCK_BENCH_VARIANT */
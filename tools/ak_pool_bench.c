@@ -0,0 +1,367 @@
+/* ak_pool_bench.c - concurrent pool benchmark for AllocKit
+
+   BUILDING
+
+       From the root of the repository, on Linux:
+
+         cc -O2 -I. -o ak_pool_bench tools/ak_pool_bench.c -lpthread
+
+   USAGE
+
+       ak_pool_bench compares the lock-free `AkAtomicPool` from
+       ak_atomic_pool.h with an `AkPool` from ak_pool.h shared behind
+       the futex lock of ak_locked.h, as the number of threads using
+       them at once grows.
+
+         $ ak_pool_bench
+         $ ak_pool_bench -t 32 -b 64 -n 1000000
+
+       Options:
+
+         -t THREADS
+           Largest number of threads (default: twice the number of
+           CPUs). The sweep doubles from 1 up to it.
+         -b BATCH
+           Number of slots each thread gets before putting them all
+           back (default: 16, at most 1024).
+         -n CALLS
+           Number of calls each thread makes to the pool, counting
+           gets and puts (default: 200000).
+
+       Both pools hand out 64-byte slots from `ak_page_allocator`, and
+       are called through `AkAlloc`, so each call goes through the
+       same function pointer. The atomic pool is sized to hold every
+       thread's batch at once, since it never grows.
+
+       It reports, for each thread count and pool:
+
+         Mcalls/s
+           Calls made by all threads together, per second of wall
+           time from when they start to when the last one finishes.
+         latency
+           Percentiles of the time each call took, across all
+           threads, measured with CLOCK_MONOTONIC around each call,
+           which adds the cost of reading the clock to each of them,
+           and to the wall time of both pools alike.
+
+ */
+
+#define _GNU_SOURCE
+
+#define ALLOCKIT_PAGE_IMPLEMENTATION
+#define ALLOCKIT_POOL_IMPLEMENTATION
+#define ALLOCKIT_ATOMIC_POOL_IMPLEMENTATION
+#define ALLOCKIT_LOCKED_IMPLEMENTATION
+#define ALLOCKIT_LOCKED_LOCK ALLOCKIT_LOCKED_FUTEX
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allockit.h"
+#include "ak_atomic_pool.h"
+#include "ak_locked.h"
+#include "ak_page.h"
+#include "ak_pool.h"
+
+#define AK_POOL_BENCH_SLOT 64
+#define AK_POOL_BENCH_ALIGN 16
+#define AK_POOL_BENCH_MAX_BATCH 1024
+#define AK_POOL_BENCH_MAX_THREADS 1024
+
+#define AK_POOL_BENCH_POOLS \
+  (sizeof(akPoolBenchPools) / sizeof(akPoolBenchPools[0]))
+
+typedef struct AkPoolBenchPool {
+  const char *name;
+  const char *description;
+  AkAlloc *(*init)(ALLOCKIT_SIZE_T slots);
+  void (*deinit)(void);
+} AkPoolBenchPool;
+
+typedef struct AkPoolBenchRun {
+  AkAlloc *alloc;
+  size_t batch;
+  size_t rounds;
+  atomic_int go;
+} AkPoolBenchRun;
+
+typedef struct AkPoolBenchThread {
+  pthread_t tid;
+  AkPoolBenchRun *run;
+  uint32_t *ns;
+  size_t len;
+  int failed;
+} AkPoolBenchThread;
+
+/* Pools. */
+
+static AkAtomicPool akPoolBenchAtomicPool;
+static AkPool akPoolBenchPool;
+static AkLocked akPoolBenchLocked;
+
+static
+AkAlloc *
+akPoolBenchAtomicInit(ALLOCKIT_SIZE_T slots)
+{
+  if (!ak_atomic_pool_init(&akPoolBenchAtomicPool, &ak_page_allocator,
+                           AK_POOL_BENCH_SLOT, AK_POOL_BENCH_ALIGN, slots))
+    return NULL;
+  return &akPoolBenchAtomicPool.alloc;
+}
+
+static
+void
+akPoolBenchAtomicDeinit(void)
+{
+  ak_atomic_pool_deinit(&akPoolBenchAtomicPool);
+}
+
+static
+AkAlloc *
+akPoolBenchLockedInit(ALLOCKIT_SIZE_T slots)
+{
+  if (!ak_pool_init(&akPoolBenchPool, &ak_page_allocator,
+                    AK_POOL_BENCH_SLOT, AK_POOL_BENCH_ALIGN, slots))
+    return NULL;
+  ak_locked_init(&akPoolBenchLocked, &akPoolBenchPool.alloc);
+  return &akPoolBenchLocked.alloc;
+}
+
+static
+void
+akPoolBenchLockedDeinit(void)
+{
+  ak_locked_deinit(&akPoolBenchLocked);
+  ak_pool_deinit(&akPoolBenchPool);
+}
+
+static const AkPoolBenchPool akPoolBenchPools[] = {
+  { "atomic", "AkAtomicPool, lock-free",
+    akPoolBenchAtomicInit, akPoolBenchAtomicDeinit },
+  { "locked", "AkPool behind AkLocked with the futex lock",
+    akPoolBenchLockedInit, akPoolBenchLockedDeinit },
+};
+
+/* Runs. */
+
+static
+uint64_t
+akPoolBenchNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static
+void
+akPoolBenchRecord(AkPoolBenchThread *thread, uint64_t start)
+{
+  uint64_t ns = akPoolBenchNow() - start;
+
+  thread->ns[thread->len++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+static
+void *
+akPoolBenchWorker(void *arg)
+{
+  AkPoolBenchThread *thread = arg;
+  AkPoolBenchRun *run = thread->run;
+  void *addrs[AK_POOL_BENCH_MAX_BATCH];
+  size_t batch = run->batch, round, i;
+  uint64_t start;
+
+  while (!atomic_load_explicit(&run->go, memory_order_acquire))
+    sched_yield();
+
+  for (round = 0; round < run->rounds; round++) {
+    for (i = 0; i < batch; i++) {
+      start = akPoolBenchNow();
+      addrs[i] = ak_alloc_raw(run->alloc, AK_POOL_BENCH_SLOT,
+                              AK_POOL_BENCH_ALIGN, 1);
+      akPoolBenchRecord(thread, start);
+      if (!addrs[i]) {
+        thread->failed = 1;
+        batch = i;
+        break;
+      }
+      *(unsigned char *)addrs[i] = (unsigned char)i;
+    }
+
+    for (i = 0; i < batch; i++) {
+      start = akPoolBenchNow();
+      ak_free(run->alloc, addrs[i]);
+      akPoolBenchRecord(thread, start);
+    }
+
+    if (thread->failed)
+      break;
+  }
+
+  return NULL;
+}
+
+static
+int
+akPoolBenchCompareNs(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/* Runs `threads` threads against `pool`, and prints a row of results.
+   Returns 0 if the pool or the threads couldn't be set up, or if the
+   pool ran out of slots. */
+static
+int
+akPoolBenchRun(const AkPoolBenchPool *pool, unsigned threads,
+               size_t batch, size_t calls)
+{
+  static const double percentiles[] = { 50, 99, 99.9 };
+  AkPoolBenchThread *ts;
+  AkPoolBenchRun run;
+  uint32_t *ns;
+  uint64_t start, elapsed;
+  size_t len, i, p;
+  unsigned started;
+  int ok = 1;
+
+  run.batch = batch;
+  run.rounds = (calls + 2 * batch - 1) / (2 * batch);
+  atomic_init(&run.go, 0);
+  run.alloc = pool->init(threads * batch);
+  if (!run.alloc)
+    return 0;
+
+  ts = calloc(threads, sizeof(AkPoolBenchThread));
+  for (i = 0; ts && i < threads; i++) {
+    ts[i].run = &run;
+    if (!(ts[i].ns = malloc(run.rounds * 2 * batch * sizeof(uint32_t))))
+      ok = 0;
+  }
+  if (!ts)
+    ok = 0;
+
+  for (started = 0; ok && started < threads; started++) {
+    if (pthread_create(&ts[started].tid, NULL, akPoolBenchWorker,
+                       &ts[started])) {
+      ok = 0;
+      break;
+    }
+  }
+
+  start = akPoolBenchNow();
+  atomic_store_explicit(&run.go, 1, memory_order_release);
+  for (i = 0; ts && i < started; i++)
+    pthread_join(ts[i].tid, NULL);
+  elapsed = akPoolBenchNow() - start;
+
+  pool->deinit();
+
+  for (len = 0, i = 0; ok && i < threads; i++) {
+    if (ts[i].failed)
+      ok = 0;
+    len += ts[i].len;
+  }
+  ns = ok ? malloc(len * sizeof(uint32_t)) : NULL;
+
+  if (ns) {
+    for (len = 0, i = 0; i < threads; i++) {
+      memcpy(ns + len, ts[i].ns, ts[i].len * sizeof(uint32_t));
+      len += ts[i].len;
+    }
+    qsort(ns, len, sizeof(uint32_t), akPoolBenchCompareNs);
+
+    printf("%8u  %-8s %9.2f", threads, pool->name,
+           (double)len * 1e3 / (double)elapsed);
+    for (p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++)
+      printf(" %8u", ns[(size_t)(percentiles[p] / 100 * (len - 1))]);
+    printf(" %9u\n", ns[len - 1]);
+  } else {
+    ok = 0;
+  }
+
+  for (i = 0; ts && i < threads; i++)
+    free(ts[i].ns);
+  free(ts);
+  free(ns);
+  return ok;
+}
+
+static
+void
+akPoolBenchUsage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-t max_threads] [-b batch] [-n calls]\n",
+          argv0);
+}
+
+int
+main(int argc, char **argv)
+{
+  unsigned long max_threads = 0, threads;
+  size_t batch = 16, calls = 200000, i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "t:b:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      max_threads = strtoul(optarg, NULL, 10);
+      break;
+    case 'b':
+      batch = strtoul(optarg, NULL, 10);
+      break;
+    case 'n':
+      calls = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      akPoolBenchUsage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc || !batch || batch > AK_POOL_BENCH_MAX_BATCH
+      || !calls) {
+    akPoolBenchUsage(argv[0]);
+    return 2;
+  }
+
+  if (!max_threads) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    max_threads = cpus > 0 ? 2 * (unsigned long)cpus : 2;
+  }
+  if (max_threads > AK_POOL_BENCH_MAX_THREADS)
+    max_threads = AK_POOL_BENCH_MAX_THREADS;
+
+  for (i = 0; i < AK_POOL_BENCH_POOLS; i++)
+    printf("%-8s %s\n", akPoolBenchPools[i].name,
+           akPoolBenchPools[i].description);
+  printf("\n%8s  %-8s %9s %8s %8s %8s %9s\n", "threads", "pool",
+         "Mcalls/s", "p50 ns", "p99", "p99.9", "max");
+
+  for (threads = 1;; threads = threads * 2 < max_threads
+                               ? threads * 2 : max_threads) {
+    for (i = 0; i < AK_POOL_BENCH_POOLS; i++) {
+      if (!akPoolBenchRun(&akPoolBenchPools[i], (unsigned)threads, batch,
+                          calls)) {
+        fprintf(stderr, "%s: could not run %s with %lu threads\n",
+                argv[0], akPoolBenchPools[i].name, threads);
+        return 1;
+      }
+    }
+    if (threads == max_threads)
+      break;
+  }
+
+  return 0;
+}
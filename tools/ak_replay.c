@@ -0,0 +1,943 @@
+/* ak_replay.c - allocation trace replay benchmark for AllocKit
+
+   BUILDING
+
+       From the root of the repository, on Linux or another POSIX
+       system:
+
+         cc -O2 -I. -o ak_replay tools/ak_replay.c -lpthread
+
+   USAGE
+
+       ak_replay reads a trace recorded with ak_trace.h, and replays
+       its calls against one of the allocators it is built with, so
+       that allocators can be compared on a real program's workload.
+
+         $ ak_replay -a tlsf alloc.trace
+         $ ak_replay -l
+
+       Options:
+
+         -a NAME
+           Allocator to replay against (default: malloc). `-l` lists
+           them. To compare another allocator, add an entry to
+           akReplayAllocators below.
+         -r SIZE
+           Size in MiB of the region given to allocators that manage
+           a single region, such as tlsf and buddy (default: 1024).
+           The region is mapped but only touched as it is used.
+
+       It reports:
+
+         wall time
+           Time taken by the calls to the allocator, and by writing to
+           the allocations, excluding the bookkeeping of the replay.
+         latency
+           Percentiles of the time each `alloc`, `resize`, `remap` and
+           `free` took, measured with CLOCK_MONOTONIC around each call,
+           which adds the cost of reading the clock to each of them.
+         peak RSS
+           The process's peak resident set, and how far it rose above
+           what it was before the replay started.
+         fragmentation
+           At the moment the resident set was largest, the share of it
+           that did not hold live bytes requested by the trace. Every
+           page of every allocation is written once, as a program would
+           write it, so that the pages count towards the resident set.
+
+       Records are replayed one at a time in the order of their
+       timestamps, on a single thread, so contention between the
+       recorded threads isn't reproduced. An allocation is identified
+       by the address it had when it was recorded; calls on addresses
+       that the trace never allocated, such as those allocated before
+       recording started, are skipped. A `resize` that the trace
+       records as successful but that fails on the replayed allocator
+       is replayed as a `remap`, as a program would fall back to
+       moving the allocation. A `remap` is replayed when the old
+       address was released, and its result only takes the new
+       address when the trace's `remap_done` says it was taken.
+
+ */
+
+#define _GNU_SOURCE
+
+#define ALLOCKIT_PAGE_IMPLEMENTATION
+#define ALLOCKIT_SLAB_IMPLEMENTATION
+#define ALLOCKIT_TLSF_IMPLEMENTATION
+#define ALLOCKIT_BUDDY_IMPLEMENTATION
+#define ALLOCKIT_THREAD_HEAP_IMPLEMENTATION
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allockit.h"
+#include "ak_buddy.h"
+#include "ak_page.h"
+#include "ak_slab.h"
+#include "ak_thread_heap.h"
+#include "ak_tlsf.h"
+#include "ak_trace.h"
+
+/* Number of records replayed between two readings of the resident
+   set. */
+#define AK_REPLAY_RSS_INTERVAL 1024
+
+typedef struct AkReplayAllocator {
+  const char *name;
+  const char *description;
+  AkAlloc *(*init)(ALLOCKIT_SIZE_T region);
+  void (*deinit)(void);
+} AkReplayAllocator;
+
+typedef struct AkReplayLive {
+  uint64_t addr;
+  void *ptr;
+  ALLOCKIT_SIZE_T size;
+  ALLOCKIT_SIZE_T align;
+  ALLOCKIT_SIZE_T count;
+} AkReplayLive;
+
+typedef struct AkReplayLatencies {
+  const char *name;
+  uint32_t *ns;
+  size_t len;
+} AkReplayLatencies;
+
+/* Allocators. */
+
+static
+void *
+akReplayMallocAlloc(AkAlloc *alloc, ALLOCKIT_SIZE_T size,
+                    ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  void *addr;
+
+  (void)alloc;
+  ALLOCKIT_ASSERT(align && (align & (align - 1)) == 0);
+
+  if (count && size > (ALLOCKIT_SIZE_T)-1 / count)
+    return NULL;
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+  if (posix_memalign(&addr, align, size * count != 0 ? size * count : 1))
+    return NULL;
+  return addr;
+}
+
+static
+int
+akReplayMallocResize(AkAlloc *alloc, void *addr, ALLOCKIT_SIZE_T size,
+                     ALLOCKIT_SIZE_T align, ALLOCKIT_SIZE_T count)
+{
+  (void)alloc;
+  (void)addr;
+  (void)size;
+  (void)align;
+  (void)count;
+  return 0;
+}
+
+static
+void
+akReplayMallocFree(AkAlloc *alloc, void *addr)
+{
+  (void)alloc;
+  free(addr);
+}
+
+static AkAlloc akReplayMalloc = {
+  akReplayMallocAlloc, akReplayMallocResize, akReplayMallocFree,
+  NULL, NULL, NULL, NULL, NULL
+};
+
+static AkSlab akReplaySlab;
+static AkTlsf *akReplayTlsf;
+static void *akReplayTlsfRegion;
+static ALLOCKIT_SIZE_T akReplayTlsfSize;
+static AkBuddy akReplayBuddy;
+static AkThreadHeap akReplayThreadHeap;
+
+static
+AkAlloc *
+akReplayMallocInit(ALLOCKIT_SIZE_T region)
+{
+  (void)region;
+  return &akReplayMalloc;
+}
+
+static
+void
+akReplayMallocDeinit(void)
+{
+}
+
+static
+AkAlloc *
+akReplayPageInit(ALLOCKIT_SIZE_T region)
+{
+  (void)region;
+  return &ak_page_allocator;
+}
+
+static
+AkAlloc *
+akReplaySlabInit(ALLOCKIT_SIZE_T region)
+{
+  (void)region;
+  ak_slab_init(&akReplaySlab, &ak_page_allocator);
+  return &akReplaySlab.alloc;
+}
+
+static
+void
+akReplaySlabDeinit(void)
+{
+  ak_slab_deinit(&akReplaySlab);
+}
+
+static
+AkAlloc *
+akReplayTlsfInit(ALLOCKIT_SIZE_T region)
+{
+  akReplayTlsf = ak_alloc(&ak_page_allocator, AkTlsf, 1);
+  akReplayTlsfRegion = ak_alloc(&ak_page_allocator, unsigned char,
+                                region);
+  akReplayTlsfSize = region;
+  if (!akReplayTlsf || !akReplayTlsfRegion
+      || !ak_tlsf_init(akReplayTlsf, akReplayTlsfRegion, region))
+    return NULL;
+  return &akReplayTlsf->alloc;
+}
+
+static
+void
+akReplayTlsfDeinit(void)
+{
+  ak_free_sized(&ak_page_allocator, akReplayTlsfRegion, unsigned char,
+                akReplayTlsfSize);
+  ak_free_sized(&ak_page_allocator, akReplayTlsf, AkTlsf, 1);
+}
+
+static
+AkAlloc *
+akReplayBuddyInit(ALLOCKIT_SIZE_T region)
+{
+  if (!ak_buddy_init(&akReplayBuddy, &ak_page_allocator, region))
+    return NULL;
+  return &akReplayBuddy.alloc;
+}
+
+static
+void
+akReplayBuddyDeinit(void)
+{
+  ak_buddy_deinit(&akReplayBuddy);
+}
+
+static
+AkAlloc *
+akReplayThreadHeapInit(ALLOCKIT_SIZE_T region)
+{
+  (void)region;
+  if (!ak_thread_heap_init(&akReplayThreadHeap, &ak_page_allocator))
+    return NULL;
+  return &akReplayThreadHeap.alloc;
+}
+
+static
+void
+akReplayThreadHeapDeinit(void)
+{
+  ak_thread_heap_deinit(&akReplayThreadHeap);
+}
+
+static const AkReplayAllocator akReplayAllocators[] = {
+  { "malloc", "the C library's posix_memalign and free",
+    akReplayMallocInit, akReplayMallocDeinit },
+  { "page", "ak_page.h, straight from mmap",
+    akReplayPageInit, akReplayMallocDeinit },
+  { "slab", "ak_slab.h over ak_page.h",
+    akReplaySlabInit, akReplaySlabDeinit },
+  { "tlsf", "ak_tlsf.h over a region from ak_page.h",
+    akReplayTlsfInit, akReplayTlsfDeinit },
+  { "buddy", "ak_buddy.h over a region from ak_page.h",
+    akReplayBuddyInit, akReplayBuddyDeinit },
+  { "thread_heap", "ak_thread_heap.h over ak_page.h",
+    akReplayThreadHeapInit, akReplayThreadHeapDeinit },
+};
+
+#define AK_REPLAY_ALLOCATORS \
+  (sizeof(akReplayAllocators) / sizeof(akReplayAllocators[0]))
+
+/* Measurement. */
+
+static
+uint64_t
+akReplayNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+/* Returns the current resident set in bytes, or 0 if it can't be
+   read. */
+static
+uint64_t
+akReplayRss(void)
+{
+  unsigned long long size, resident;
+  FILE *statm = fopen("/proc/self/statm", "r");
+  int got;
+
+  if (!statm)
+    return 0;
+  got = fscanf(statm, "%llu %llu", &size, &resident);
+  fclose(statm);
+  if (got != 2)
+    return 0;
+  return (uint64_t)resident * (uint64_t)sysconf(_SC_PAGESIZE);
+}
+
+static
+void
+akReplayRecordLatency(AkReplayLatencies *lat, uint64_t start)
+{
+  uint64_t ns = akReplayNow() - start;
+
+  lat->ns[lat->len++] = ns > UINT32_MAX ? UINT32_MAX : (uint32_t)ns;
+}
+
+static
+int
+akReplayCompareNs(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+static
+void
+akReplayPrintLatencies(AkReplayLatencies *lat)
+{
+  static const double percentiles[] = { 50, 90, 99, 99.9 };
+  size_t i;
+
+  if (!lat->len)
+    return;
+
+  qsort(lat->ns, lat->len, sizeof(uint32_t), akReplayCompareNs);
+  printf("  %-8s %10zu calls ", lat->name, lat->len);
+  for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++)
+    printf("  p%-4g %7u", percentiles[i],
+           lat->ns[(size_t)(percentiles[i] / 100 * (lat->len - 1))]);
+  printf("  max %9u ns\n", lat->ns[lat->len - 1]);
+}
+
+/* Writes to every page of an allocation, so that it is resident. */
+static
+void
+akReplayTouch(void *ptr, uint64_t bytes)
+{
+  volatile unsigned char *p = ptr;
+  uint64_t i;
+
+  for (i = 0; i < bytes; i += 4096)
+    p[i] = 1;
+  if (bytes)
+    p[bytes - 1] = 1;
+}
+
+/* Trace loading. */
+
+static const AkTraceRecord *akReplaySortRecords;
+
+static
+int
+akReplayCompareOrder(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  uint64_t tx = akReplaySortRecords[x].time;
+  uint64_t ty = akReplaySortRecords[y].time;
+
+  if (tx != ty)
+    return (tx > ty) - (tx < ty);
+  return (x > y) - (x < y);
+}
+
+static
+AkTraceRecord *
+akReplayLoad(const char *path, size_t *len)
+{
+  AkTraceFileHeader header;
+  AkTraceRecord *records = NULL;
+  size_t cap = 0, n = 0;
+  FILE *in = fopen(path, "rb");
+
+  if (!in) {
+    perror(path);
+    return NULL;
+  }
+
+  if (fread(&header, sizeof(header), 1, in) != 1
+      || memcmp(header.magic, ALLOCKIT_TRACE_MAGIC,
+                sizeof(ALLOCKIT_TRACE_MAGIC)) != 0
+      || header.version != ALLOCKIT_TRACE_VERSION
+      || header.record_size != sizeof(AkTraceRecord)) {
+    fprintf(stderr, "%s: not a version %d AllocKit trace written on this "
+                    "kind of machine\n", path, ALLOCKIT_TRACE_VERSION);
+    fclose(in);
+    return NULL;
+  }
+
+  for (;;) {
+    if (n == cap) {
+      AkTraceRecord *grown;
+
+      cap = cap ? cap * 2 : 65536;
+      grown = realloc(records, cap * sizeof(AkTraceRecord));
+      if (!grown) {
+        fprintf(stderr, "%s: out of memory\n", path);
+        free(records);
+        fclose(in);
+        return NULL;
+      }
+      records = grown;
+    }
+
+    n += fread(records + n, sizeof(AkTraceRecord), cap - n, in);
+    if (n < cap)
+      break;
+  }
+
+  fclose(in);
+  *len = n;
+  return records;
+}
+
+/* Table of live allocations, keyed by their recorded address, with
+   open addressing and linear probing. */
+
+typedef struct AkReplayTable {
+  AkReplayLive *slots;
+  size_t mask;
+  size_t used;
+} AkReplayTable;
+
+static
+size_t
+akReplayHome(AkReplayTable *table, uint64_t addr)
+{
+  return (size_t)((addr * 0x9e3779b97f4a7c15ull) >> 20) & table->mask;
+}
+
+static
+AkReplayLive *
+akReplaySlot(AkReplayTable *table, uint64_t addr)
+{
+  size_t i = akReplayHome(table, addr);
+
+  while (table->slots[i].addr && table->slots[i].addr != addr)
+    i = (i + 1) & table->mask;
+  return &table->slots[i];
+}
+
+/* Fills in the empty slot found for live->addr, and doubles the table
+   once it is half full. The table is sized before the replay from an
+   estimate, so this rarely happens. */
+static
+int
+akReplayInsert(AkReplayTable *table, AkReplayLive *slot,
+               const AkReplayLive *live)
+{
+  AkReplayTable grown;
+  size_t i;
+
+  *slot = *live;
+  if (++table->used * 2 <= table->mask + 1)
+    return 1;
+
+  grown.mask = table->mask * 2 + 1;
+  grown.used = table->used;
+  grown.slots = calloc(grown.mask + 1, sizeof(AkReplayLive));
+  if (!grown.slots)
+    return 0;
+
+  for (i = 0; i <= table->mask; i++)
+    if (table->slots[i].addr)
+      *akReplaySlot(&grown, table->slots[i].addr) = table->slots[i];
+
+  free(table->slots);
+  *table = grown;
+  return 1;
+}
+
+static
+void
+akReplayRemove(AkReplayTable *table, AkReplayLive *slot)
+{
+  size_t i = (size_t)(slot - table->slots), j = i;
+
+  /* Moves later entries of the probe sequence back into the hole. */
+  slot->addr = 0;
+  table->used--;
+  for (;;) {
+    AkReplayLive *next;
+    size_t home;
+
+    j = (j + 1) & table->mask;
+    next = &table->slots[j];
+    if (!next->addr)
+      return;
+
+    home = akReplayHome(table, next->addr);
+    if (((j - home) & table->mask) >= ((j - i) & table->mask)) {
+      table->slots[i] = *next;
+      next->addr = 0;
+      i = j;
+    }
+  }
+}
+
+/* Estimates the most allocations that are live at once in the trace,
+   so that the table can be sized before the replay. */
+static
+size_t
+akReplayMaxLive(const AkTraceRecord *records, size_t len)
+{
+  size_t i, live = 0, max = 0;
+
+  for (i = 0; i < len; i++) {
+    const AkTraceRecord *r = &records[i];
+
+    if ((r->op == ALLOCKIT_TRACE_OP_ALLOC
+         || (r->op == ALLOCKIT_TRACE_OP_REMAP_DONE && !r->prev)) && r->ok)
+      live++;
+    else if ((r->op == ALLOCKIT_TRACE_OP_FREE
+              || r->op == ALLOCKIT_TRACE_OP_FREE_SIZED) && live)
+      live--;
+    if (live > max)
+      max = live;
+  }
+
+  return max;
+}
+
+/* Returns the number of threads that recorded the trace. */
+static
+size_t
+akReplayThreads(const AkTraceRecord *records, size_t len)
+{
+  size_t i, threads = 0;
+
+  for (i = 0; i < len; i++)
+    if (records[i].thread >= threads)
+      threads = (size_t)records[i].thread + 1;
+
+  return threads;
+}
+
+/* Replay. */
+
+typedef struct AkReplayResult {
+  uint64_t wall;
+  uint64_t skipped;
+  uint64_t failed;
+  uint64_t live_bytes;
+  uint64_t peak_live_bytes;
+  uint64_t peak_rss;
+  uint64_t live_at_peak_rss;
+} AkReplayResult;
+
+/* Returns 0 if the replay ran out of memory for its own bookkeeping.
+   `pending` holds, for each recorded thread, the result of a `remap`
+   that has been replayed but whose `remap_done` hasn't. */
+static
+int
+akReplayRun(AkAlloc *alloc, const AkTraceRecord *records,
+            const uint32_t *order, size_t len, AkReplayTable *table,
+            AkReplayLive *pending, AkReplayLatencies *lat,
+            AkReplayResult *result)
+{
+  AkReplayLatencies *allocs = &lat[0], *resizes = &lat[1];
+  AkReplayLatencies *remaps = &lat[2], *frees = &lat[3];
+  uint64_t start, rss;
+  size_t i;
+
+  for (i = 0; i < len; i++) {
+    const AkTraceRecord *r = &records[order[i]];
+    ALLOCKIT_SIZE_T align = (ALLOCKIT_SIZE_T)1 << r->align_log2;
+    AkReplayLive *slot = NULL, *prev = NULL, live;
+    void *ptr;
+
+    if (i % AK_REPLAY_RSS_INTERVAL == 0) {
+      rss = akReplayRss();
+      if (rss > result->peak_rss) {
+        result->peak_rss = rss;
+        result->live_at_peak_rss = result->live_bytes;
+      }
+    }
+
+    switch (r->op) {
+    case ALLOCKIT_TRACE_OP_ALLOC:
+      if (!r->ok)
+        break;
+      slot = akReplaySlot(table, r->addr);
+      if (slot->addr) {
+        result->skipped++;
+        break;
+      }
+
+      start = akReplayNow();
+      ptr = ak_alloc_raw(alloc, r->size, align, r->count);
+      akReplayRecordLatency(allocs, start);
+      if (!ptr) {
+        result->failed++;
+        break;
+      }
+      akReplayTouch(ptr, r->size * r->count);
+      result->wall += akReplayNow() - start;
+
+      live.addr = r->addr;
+      live.ptr = ptr;
+      live.size = r->size;
+      live.align = align;
+      live.count = r->count;
+      if (!akReplayInsert(table, slot, &live))
+        return 0;
+      result->live_bytes += r->size * r->count;
+      break;
+
+    case ALLOCKIT_TRACE_OP_RESIZE:
+      if (!r->ok)
+        break;
+      slot = akReplaySlot(table, r->addr);
+      if (!slot->addr) {
+        result->skipped++;
+        break;
+      }
+
+      start = akReplayNow();
+      if (ak_resize_raw(alloc, slot->ptr, r->size, align, r->count)) {
+        akReplayRecordLatency(resizes, start);
+        ptr = slot->ptr;
+      } else {
+        ptr = ak_remap_raw(alloc, slot->ptr, r->size, align, slot->count,
+                           r->count);
+        akReplayRecordLatency(remaps, start);
+        if (!ptr) {
+          result->failed++;
+          break;
+        }
+      }
+      if (r->size * r->count > slot->size * slot->count)
+        akReplayTouch(ptr, r->size * r->count);
+      result->wall += akReplayNow() - start;
+
+      result->live_bytes += r->size * r->count;
+      result->live_bytes -= slot->size * slot->count;
+      slot->ptr = ptr;
+      slot->size = r->size;
+      slot->count = r->count;
+      break;
+
+    case ALLOCKIT_TRACE_OP_REMAP:
+      if (!r->ok)
+        break;
+      if (r->prev) {
+        prev = akReplaySlot(table, r->prev);
+        if (!prev->addr) {
+          result->skipped++;
+          break;
+        }
+      }
+
+      start = akReplayNow();
+      ptr = ak_remap_raw(alloc, prev ? prev->ptr : NULL, r->size, align,
+                         prev ? prev->count : 0, r->count);
+      akReplayRecordLatency(remaps, start);
+      if (!ptr) {
+        result->failed++;
+        break;
+      }
+      akReplayTouch(ptr, r->size * r->count);
+      result->wall += akReplayNow() - start;
+
+      if (prev) {
+        result->live_bytes -= prev->size * prev->count;
+        akReplayRemove(table, prev);
+      }
+      live.addr = r->addr;
+      live.ptr = ptr;
+      live.size = r->size;
+      live.align = align;
+      live.count = r->count;
+      pending[r->thread] = live;
+      result->live_bytes += r->size * r->count;
+      break;
+
+    case ALLOCKIT_TRACE_OP_REMAP_DONE:
+      /* The `remap` was skipped or failed if nothing is pending, and
+         already counted. */
+      live = pending[r->thread];
+      if (!r->ok || !live.addr)
+        break;
+      pending[r->thread].addr = 0;
+
+      slot = akReplaySlot(table, r->addr);
+      if (slot->addr) {
+        result->skipped++;
+        result->live_bytes -= live.size * live.count;
+        ak_free(alloc, live.ptr);
+        break;
+      }
+      if (!akReplayInsert(table, slot, &live))
+        return 0;
+      break;
+
+    case ALLOCKIT_TRACE_OP_FREE:
+    case ALLOCKIT_TRACE_OP_FREE_SIZED:
+      slot = akReplaySlot(table, r->addr);
+      if (!slot->addr) {
+        result->skipped++;
+        break;
+      }
+
+      start = akReplayNow();
+      if (r->op == ALLOCKIT_TRACE_OP_FREE)
+        ak_free(alloc, slot->ptr);
+      else
+        ak_free_sized_raw(alloc, slot->ptr, slot->size, slot->align,
+                          slot->count);
+      akReplayRecordLatency(frees, start);
+      result->wall += akReplayNow() - start;
+
+      result->live_bytes -= slot->size * slot->count;
+      akReplayRemove(table, slot);
+      break;
+
+    default:
+      result->skipped++;
+      break;
+    }
+
+    if (result->live_bytes > result->peak_live_bytes)
+      result->peak_live_bytes = result->live_bytes;
+  }
+
+  return 1;
+}
+
+static
+void
+akReplayUsage(const char *argv0)
+{
+  fprintf(stderr, "usage: %s [-a allocator] [-r region_mib] trace\n"
+                  "       %s -l\n", argv0, argv0);
+}
+
+int
+main(int argc, char **argv)
+{
+  const AkReplayAllocator *chosen = &akReplayAllocators[0];
+  AkReplayLatencies lat[4] = {
+    { "alloc", NULL, 0 }, { "resize", NULL, 0 },
+    { "remap", NULL, 0 }, { "free", NULL, 0 }
+  };
+  AkReplayResult result = {0};
+  ALLOCKIT_SIZE_T region = (ALLOCKIT_SIZE_T)1024 << 20;
+  AkReplayTable table;
+  AkReplayLive *pending;
+  AkTraceRecord *records;
+  uint32_t *order;
+  struct rusage usage;
+  uint64_t baseline, rss;
+  AkAlloc *alloc;
+  size_t len, cap, i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "a:r:l")) != -1) {
+    switch (opt) {
+    case 'a':
+      for (i = 0; i < AK_REPLAY_ALLOCATORS; i++)
+        if (strcmp(akReplayAllocators[i].name, optarg) == 0)
+          break;
+      if (i == AK_REPLAY_ALLOCATORS) {
+        fprintf(stderr, "%s: unknown allocator '%s', see -l\n", argv[0],
+                optarg);
+        return 2;
+      }
+      chosen = &akReplayAllocators[i];
+      break;
+    case 'r':
+      region = (ALLOCKIT_SIZE_T)strtoull(optarg, NULL, 10) << 20;
+      break;
+    case 'l':
+      for (i = 0; i < AK_REPLAY_ALLOCATORS; i++)
+        printf("%-12s %s\n", akReplayAllocators[i].name,
+               akReplayAllocators[i].description);
+      return 0;
+    default:
+      akReplayUsage(argv[0]);
+      return 2;
+    }
+  }
+
+  if (optind != argc - 1 || !region) {
+    akReplayUsage(argv[0]);
+    return 2;
+  }
+
+  records = akReplayLoad(argv[optind], &len);
+  if (!records)
+    return 1;
+  if (len > UINT32_MAX) {
+    fprintf(stderr, "%s: too many records\n", argv[optind]);
+    return 1;
+  }
+
+  order = malloc((len ? len : 1) * sizeof(uint32_t));
+  for (i = 0; order && i < 4; i++)
+    if (!(lat[i].ns = malloc((len ? len : 1) * sizeof(uint32_t))))
+      order = NULL;
+  for (cap = 64; cap < akReplayMaxLive(records, len) * 2; cap *= 2)
+    ;
+  table.slots = calloc(cap, sizeof(AkReplayLive));
+  table.mask = cap - 1;
+  table.used = 0;
+  pending = calloc(akReplayThreads(records, len) + 1, sizeof(AkReplayLive));
+  if (!order || !table.slots || !pending) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+  }
+
+  for (i = 0; i < len; i++)
+    order[i] = (uint32_t)i;
+  akReplaySortRecords = records;
+  qsort(order, len, sizeof(uint32_t), akReplayCompareOrder);
+
+  /* Touches the latency buffers, so that they are already resident in
+     the baseline. */
+  for (i = 0; i < 4; i++)
+    memset(lat[i].ns, 0, (len ? len : 1) * sizeof(uint32_t));
+
+  alloc = chosen->init(region);
+  if (!alloc) {
+    fprintf(stderr, "%s: could not initialize %s\n", argv[0],
+            chosen->name);
+    return 1;
+  }
+
+  baseline = akReplayRss();
+  if (!akReplayRun(alloc, records, order, len, &table, pending, lat,
+                   &result)) {
+    fprintf(stderr, "%s: out of memory\n", argv[0]);
+    return 1;
+  }
+  rss = akReplayRss();
+  if (rss > result.peak_rss) {
+    result.peak_rss = rss;
+    result.live_at_peak_rss = result.live_bytes;
+  }
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("allocator      %s\n", chosen->name);
+  printf("records        %zu (%llu skipped, %llu failed)\n", len,
+         (unsigned long long)result.skipped,
+         (unsigned long long)result.failed);
+  printf("wall time      %.3f ms\n", result.wall / 1e6);
+  printf("latency (ns)\n");
+  for (i = 0; i < 4; i++)
+    akReplayPrintLatencies(&lat[i]);
+  printf("peak live      %.2f MiB\n", result.peak_live_bytes / 1048576.0);
+  printf("peak RSS       %.2f MiB (process), ", usage.ru_maxrss / 1024.0);
+  if (baseline && result.peak_rss > baseline) {
+    uint64_t grown = result.peak_rss - baseline;
+
+    printf("%.2f MiB above baseline\n", grown / 1048576.0);
+    printf("fragmentation  %.1f%% of RSS growth not live at peak RSS\n",
+           grown > result.live_at_peak_rss
+           ? 100.0 * (grown - result.live_at_peak_rss) / grown
+           : 0.0);
+  } else {
+    printf("no growth above baseline measured\n");
+  }
+
+  for (i = 0; i <= table.mask; i++)
+    if (table.slots[i].addr)
+      ak_free(alloc, table.slots[i].ptr);
+  for (i = 0; i <= akReplayThreads(records, len); i++)
+    if (pending[i].addr)
+      ak_free(alloc, pending[i].ptr);
+  chosen->deinit();
+
+  for (i = 0; i < 4; i++)
+    free(lat[i].ns);
+  free(table.slots);
+  free(pending);
+  free(order);
+  free(records);
+  return 0;
+}
+
+/*
+  This software is available under 2 licenses, choose whichever you
+  prefer:
+
+  ALTERNATIVE A - Public Domain (www.unlicense.org)
+    This is free and unencumbered software released into the public
+    domain.
+
+    Anyone is free to copy, modify, publish, use, compile, sell, or
+    distribute this software, either in source code form or as a
+    compiled binary, for any purpose, commercial or non-commercial,
+    and by any means.
+
+    In jurisdictions that recognize copyright laws, the author or
+    authors of this software dedicate any and all copyright interest
+    in the software to the public domain. We make this dedication for
+    the benefit of the public at large and to the detriment of our
+    heirs and successors. We intend this dedication to be an overt act
+    of relinquishment in perpetuity of all present and future rights
+    to this software under copyright law.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS BE LIABLE FOR ANY
+    CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+    For more information, please refer to <http://unlicense.org/>
+
+  ALTERNATIVE B - MIT License
+    Copyright (c) 2024 lambdadog
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation
+    files (the "Software"), to deal in the Software without
+    restriction, including without limitation the rights to use, copy,
+    modify, merge, publish, distribute, sublicense, and/or sell copies
+    of the Software, and to permit persons to whom the Software is
+    furnished to do so, subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+    NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+    HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+    WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+    OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+    DEALINGS IN THE SOFTWARE.
+ */